@@ -3,8 +3,56 @@
 #include <ads-vocab.hpp>
 #include <audiorw.hpp>
 #include <ez.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
 #include <memory>
-#include <immer/table.hpp>
+#include <mutex>
+#include <numbers>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#	define AFS_X86 1
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#		define AFS_TARGET_AVX2
+#	else
+#		include <immintrin.h>
+#		define AFS_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#	endif
+#else
+#	define AFS_X86 0
+#endif
 
 namespace audiorw { struct header; }
 
@@ -19,402 +67,3574 @@ template <typename T, typename... Args> auto make_uptr(Args&&... args)  { return
 
 using output_signal = std::array<float*, 2>;
 
+enum class interpolation {
+	linear, // Cheap linear interpolation.
+	sinc    // Band-limited windowed-sinc interpolation.
+};
+
+enum class sample_format {
+	uint8,
+	int16,
+	int24, // Packed into three bytes.
+	int32,
+	float16,
+	float32
+};
+
+// Counts of the work a streamer's loader has done so far.
+struct loader_stats {
+	uint64_t chunks_decoded = 0;
+	uint64_t stream_seeks   = 0; // Calls to the stream's seek() or seek_to(). Sequential chunks don't need one.
+};
+
+// A place a stream can resume decoding from without decoding everything
+// before it, e.g. an MP3 frame header. frame is the first frame decoded
+// after resuming there.
+struct stream_seek_point {
+	size_t byte_offset = 0;
+	ads::frame_idx frame;
+};
+
+namespace concepts {
+
+// Optional stream capability for formats which can't seek to an arbitrary
+// frame (MP3.) get_seek_point() returns a point to resume from to decode
+// the next frame read_frames() would return. It can be a few frames before
+// that frame if the decoder needs priming. seek_to() resumes from a point
+// returned earlier, after which get_total_bytes_read() should count on from
+// the point's byte_offset.
+template <typename T>
+concept seek_point_stream = requires (T x, afs::stream_seek_point point) {
+	{ x.get_seek_point() } -> std::same_as<afs::stream_seek_point>;
+	x.seek_to(point);
+};
+
+} // concepts
+
 } // afs
 
-namespace afs::detail {
+namespace afs::detail {
+
+struct loader_wakeup;
+struct pool;
+
+enum class state {
+	playing,
+	finished
+};
+
+struct target {
+	ads::frame_idx seek_pos;
+};
+
+// A chunk's frames in the streamer's storage format, one channel after
+// another. Chunks of digital silence share a single silent chunk which has
+// no bytes at all. The chunk under the playhead is published while it is
+// still being decoded, so only frames [ready_beg, ready_frames) can be read.
+struct chunk_data {
+	afs::sample_format format = afs::sample_format::float32;
+	size_t frame_count = 0; // Per channel. Only the last chunk is shorter than the stream's chunk size.
+	bool silent        = false;
+	std::atomic<size_t> ready_beg    = 0;
+	std::atomic<size_t> ready_frames = 0;
+	std::vector<std::byte> bytes;
+};
+
+// A limit on the memory used by the chunks of any number of streamers.
+struct memory_budget {
+	size_t max_bytes = 0;
+	std::atomic<size_t> used = 0;
+	// The loaders to wake up when bytes are given back, in case they were
+	// waiting for room. Managed by the streamers using the budget.
+	std::mutex wake_mutex;
+	std::vector<detail::loader_wakeup*> wake_threads;
+	std::unordered_map<detail::pool*, size_t> wake_pools; // And how many of the streamers are on each.
+};
+
+struct ready_range {
+	size_t beg = 0;
+	size_t end = 0;
+};
+
+// Flat chunk index -> chunk data lookup for the audio thread. Slots are
+// grouped into pages which are allocated by the loader thread (or up front
+// if the frame count is known) and are never freed until the streamer is
+// destroyed. The chunk data itself is owned by the loader.
+struct chunk_dir {
+	static constexpr auto PAGE_SIZE = size_t{1024};
+	static constexpr auto MAX_PAGES = size_t{1024};
+	using slot = std::atomic<const chunk_data*>;
+	using page = std::array<slot, PAGE_SIZE>;
+	std::array<std::atomic<page*>, MAX_PAGES> pages;
+	std::array<uptr<page>, MAX_PAGES> page_storage;
+	size_t chunk_size = 0; // Frames per chunk. Chosen before the loader starts and never changed.
+};
+
+// One bit per chunk, set when the chunk is loaded and cleared if it is
+// evicted. Only the loader writes to it but it can be read from any thread
+// without touching the model. Pages are allocated by the loader as needed.
+// The capacity matches the chunk directory's.
+struct chunk_bitmap {
+	static constexpr auto PAGE_WORDS = size_t{1024};
+	static constexpr auto MAX_PAGES  = size_t{16};
+	static constexpr auto CAPACITY   = PAGE_WORDS * MAX_PAGES * 64;
+	using page = std::array<std::atomic<uint64_t>, PAGE_WORDS>;
+	std::array<std::atomic<page*>, MAX_PAGES> pages;
+	std::array<uptr<page>, MAX_PAGES> page_storage;
+	std::atomic<size_t> size = 0; // One past the highest bit ever set.
+};
+
+struct model {
+	audiorw::header header;
+	detail::target target;
+	ads::frame_count estimated_frame_count;
+};
+
+// The parts of the model which the audio thread needs. The audio thread
+// keeps its own copy, which it only refreshes from the snapshot_slot when a
+// new version has been published. It never reads the model itself, so it
+// never shares ownership of it.
+struct snapshot {
+	uint64_t version = 0;
+	ads::channel_count channel_count;
+	double SR = 0.0;
+	ads::frame_count estimated_frame_count;
+	bool frame_count_known = false; // If not, the estimate is only a guess, and is 0 until the loader has read something.
+	detail::target target;
+};
+
+// Whoever publishes a new model writes its snapshot in here too. This is a
+// seqlock: seq is odd while a write is in progress, and the audio thread
+// throws away anything it read while seq changed underneath it.
+struct snapshot_slot {
+	std::mutex mutex; // Held while publishing, so that snapshots are written in the same order as the models.
+	std::atomic<uint64_t> seq                   = 0;
+	std::atomic<uint64_t> channel_count         = 0;
+	std::atomic<double> SR                      = 0.0;
+	std::atomic<uint64_t> estimated_frame_count = 0;
+	std::atomic<bool> frame_count_known         = false;
+	std::atomic<int64_t> seek_pos               = 0;
+};
+
+enum class isa {
+	scalar,
+	sse,
+	avx2
+};
+
+// Polyphase windowed-sinc filter. Coefficients are linearly interpolated
+// between adjacent phases.
+struct sinc_table {
+	static constexpr auto TAPS   = size_t{32};
+	static constexpr auto PHASES = size_t{256};
+	alignas(32) std::array<float, TAPS * (PHASES + 1)> coeffs;
+};
+
+// One filter per downsampling ratio so that the cutoff can be lowered below
+// the output Nyquist frequency. Upsampling always uses the first one.
+struct sinc_bank {
+	static constexpr auto RATIOS = std::array{1.0, 1.125, 1.25, 1.5, 2.0, 3.0, 4.0};
+	std::array<sinc_table, RATIOS.size()> tables;
+};
+
+// How many input frames the interpolation kernel reads before and after the
+// frame under the playhead.
+struct kernel_reach {
+	int64_t before;
+	int64_t after;
+};
+
+// Scratch space for the audio thread. Input frames are gathered in here from
+// the chunks so that the interpolation kernels can read them contiguously.
+struct resampler {
+	static constexpr auto SCRATCH_SIZE = size_t{4096};
+	std::vector<float> buffer;
+};
+
+struct servo {
+	detail::state state = state::playing;
+	ads::frame_idx playback_beg;
+	double playback_pos = 0.0;
+};
+
+struct shared_atomics {
+	std::atomic<bool> request_playback_pos    = false;
+	std::atomic<bool> reported_finished       = false;
+	std::atomic<double> reported_playback_pos = 0.0;
+	std::atomic<int64_t> reported_playback_beg = 0; // The last seek target the audio thread has gone to.
+	std::atomic<uint64_t> model_version       = 0;
+	std::atomic<afs::interpolation> interpolation = afs::interpolation::linear;
+	std::atomic<uint64_t> audio_epoch         = 0; // Odd while the audio thread is inside process().
+	std::atomic<uint64_t> chunks_decoded      = 0;
+	std::atomic<uint64_t> stream_seeks        = 0;
+};
+
+struct shared_safe {
+	ez::sync<detail::model> model;
+	detail::snapshot_slot published;
+	detail::chunk_dir chunks;
+	detail::chunk_bitmap loaded;
+	detail::shared_atomics atomics;
+};
+
+// How long a loader waits before trying again when the only thing it has
+// left to do is free evicted chunks which the audio thread might still be
+// reading. Also the shortest it waits for anything else.
+static constexpr auto LOADER_IDLE_WAIT = std::chrono::milliseconds{10};
+
+// How long the audio thread is given to answer a request for the playback
+// position.
+static constexpr auto PLAYBACK_POS_WAIT = std::chrono::milliseconds{1};
+
+// How far the playhead can get past the end of an MP3's seek index before
+// the loader stops decoding its way there and jumps to an estimated byte
+// offset instead, and how many chunks it loads from there.
+static constexpr auto APPROXIMATE_SEEK_DISTANCE  = size_t{16};
+static constexpr auto APPROXIMATE_SEEK_LOOKAHEAD = size_t{4};
+
+// Frames decoded and thrown away after an approximate jump, so that the
+// decoder has resynchronised and refilled its bit reservoir by the time the
+// chunk starts.
+static constexpr auto APPROXIMATE_SEEK_PRIMING = int64_t{2304};
+
+// Chunks are decoded a slice at a time so that the loader can give up on
+// one part way through if the playhead jumps somewhere else, and so that
+// each slice is still in cache when it is copied into the chunk. A slice
+// is at most this many frames, and its interleaved float samples are at
+// most DECODE_SLICE_BYTES.
+static constexpr auto DECODE_SLICE_SIZE  = size_t{8192};
+static constexpr auto DECODE_SLICE_BYTES = size_t{32768};
+
+enum class load_result {
+	loaded,      // A chunk was loaded.
+	interrupted, // A seek landed somewhere else while a chunk was being decoded.
+	idle,        // Nothing can be loaded right now. Try again at the loader's retry_at, or when woken.
+	finished     // There is nothing left to load.
+};
+
+// A streamer's loading work, as seen by a shared loader pool.
+struct pool_job {
+	std::function<load_result()> load_next_chunk;
+	std::function<double()> get_priority; // Seconds until the next chunk will be needed.
+	std::function<std::chrono::steady_clock::time_point()> get_retry_at; // When to try again after load_next_chunk() was idle.
+	std::chrono::steady_clock::time_point retry_at = {};
+	bool busy  = false;
+	bool woken = false; // Something happened while the job was running which might let it load more.
+	bool done = false;
+};
+
+// Wakes an idle loader thread early, e.g. because of a seek, or so that it
+// can stop.
+struct loader_wakeup {
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool signalled = false;
+	bool quit      = false;
+};
+
+struct pool {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<shptr<pool_job>> jobs;
+	bool quit = false;
+};
+
+// Removes the job from the pool when destroyed, waiting for a worker to
+// finish with it first if necessary.
+struct pool_registration {
+	detail::pool* pool = nullptr;
+	shptr<pool_job> job;
+	pool_registration() = default;
+	pool_registration(const pool_registration&) = delete;
+	auto operator=(const pool_registration&) -> pool_registration& = delete;
+	~pool_registration();
+};
+
+struct decoded_chunk {
+	shptr<const chunk_data> data;
+	ads::frame_count frame_count; // Less than the chunk size if this is the last chunk.
+};
+
+struct cache_key {
+	std::string identity;
+	size_t chunk_size = 0;
+	size_t chunk_idx  = 0;
+	afs::sample_format format = afs::sample_format::float32;
+	auto operator==(const cache_key&) const -> bool = default;
+};
+
+struct cache_key_hash {
+	auto operator()(const cache_key& x) const -> size_t {
+		auto out = std::hash<std::string>{}(x.identity);
+		out ^= std::hash<size_t>{}(x.chunk_size) + 0x9e3779b9 + (out << 6) + (out >> 2);
+		out ^= std::hash<size_t>{}(x.chunk_idx) + 0x9e3779b9 + (out << 6) + (out >> 2);
+		out ^= std::hash<afs::sample_format>{}(x.format) + 0x9e3779b9 + (out << 6) + (out >> 2);
+		return out;
+	}
+};
+
+struct cache_entry {
+	shptr<const detail::chunk_data> data;
+	ads::frame_count frame_count;
+	size_t bytes = 0;
+	std::list<cache_key>::iterator lru_pos;
+};
+
+// Decoded chunks which outlive the streamers that loaded them. The chunk
+// data is shared with any streamers using it, so the cache only decides
+// how long it stays around after they are gone.
+struct chunk_cache {
+	std::mutex mutex;
+	std::unordered_map<cache_key, cache_entry, cache_key_hash> entries;
+	std::list<cache_key> lru; // Most recently used first.
+	size_t max_bytes = 0;
+	size_t bytes     = 0;
+};
+
+// A read-only mapping of a whole file.
+struct mapped_file {
+	const std::byte* data = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	HANDLE file    = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	auto operator=(const mapped_file&) -> mapped_file& = delete;
+	~mapped_file();
+};
+
+// An uncompressed WAV file which is played straight out of a mapping of it
+// instead of being loaded into chunks.
+struct mapped_wav {
+	uptr<detail::mapped_file> file;
+	const std::byte* frames = nullptr;
+	afs::sample_format format = afs::sample_format::int16;
+	size_t bytes_per_sample = 0;
+	size_t block_align      = 0;
+	uint64_t frame_count    = 0;
+};
+
+// The parts of an MP3 frame header needed to walk from one MP3 frame to the
+// next.
+struct mp3_frame_header {
+	uint32_t version = 0; // The raw version bits. 3 is MPEG 1.
+	uint32_t layer   = 0;
+	uint32_t SR      = 0;
+	size_t frames    = 0; // Audio frames decoded from this MP3 frame.
+	size_t bytes     = 0; // Including the header.
+	size_t side_info_bytes = 0;
+};
+
+// What the Xing/Info or VBRI header in an MP3's first frame says, if there
+// is one.
+struct mp3_info {
+	bool is_info_frame = false; // The first frame holds the header instead of audio.
+	std::optional<ads::frame_count> frame_count;
+};
+
+// Decoded chunks of compressed files are appended to a cache file as
+// records, each of which is a disk_cache_record_header followed by
+// byte_count bytes of chunk data, one channel after another. The file starts with a
+// disk_cache_header followed by the identity string.
+static constexpr auto DISK_CACHE_MAGIC = std::array{'a', 'f', 's', 'p', 'c', 'm', '0', '3'};
+
+struct disk_cache_header {
+	std::array<char, 8> magic;
+	uint32_t chunk_size    = 0;
+	uint32_t channel_count = 0;
+	uint32_t format        = 0; // afs::sample_format
+	uint32_t reserved      = 0;
+	uint64_t identity_size = 0;
+};
+
+struct disk_cache_record_header {
+	uint64_t chunk_idx   = 0;
+	uint64_t frame_count = 0;
+	uint64_t byte_count  = 0; // 0 if the chunk is silent.
+};
+
+struct disk_cache_record {
+	size_t offset = 0; // Of the chunk data in the mapping.
+	ads::frame_count frame_count;
+	size_t byte_count = 0;
+};
+
+// One cache file, shared by every streamer of the same file. Chunks are
+// read from the mapping made when the file was opened. Chunks written
+// after that are already in memory so they don't need to be readable.
+struct disk_cache_file {
+	std::mutex mutex;
+	uptr<detail::mapped_file> mapping;
+	std::unordered_map<size_t, disk_cache_record> records;
+	std::unordered_set<size_t> written;
+	std::ofstream out;
+	size_t channel_count = 0;
+	afs::sample_format format = afs::sample_format::float32;
+};
+
+// Chunk buffers which have been freed, kept for reuse by chunks of the same
+// size so that loading and evicting chunks doesn't keep going back to the
+// heap. Keyed by byte count. The blocks each chunk_data was allocated in,
+// along with its reference count, are kept for reuse too. Once bytes
+// reaches max_bytes, freed buffers and blocks are really freed. Chunks and
+// loaders using the pool share ownership of it, so it lasts as long as the
+// last chunk made from it.
+struct chunk_pool : std::enable_shared_from_this<chunk_pool> {
+	std::mutex mutex;
+	std::unordered_map<size_t, std::vector<std::vector<std::byte>>> buffers;
+	std::unordered_map<size_t, std::vector<void*>> blocks;
+	size_t max_bytes = 0;
+	size_t bytes     = 0;
+	chunk_pool() = default;
+	chunk_pool(const chunk_pool&) = delete;
+	auto operator=(const chunk_pool&) -> chunk_pool& = delete;
+	~chunk_pool();
+};
+
+// Used with std::allocate_shared so that a chunk_data and its reference
+// count come out of a single block from the pool. When the chunk is
+// destroyed its bytes go back to the pool as well.
+template <typename T>
+struct chunk_allocator {
+	using value_type = T;
+	shptr<detail::chunk_pool> pool;
+	explicit chunk_allocator(shptr<detail::chunk_pool> pool) : pool{std::move(pool)} {}
+	template <typename U> chunk_allocator(const chunk_allocator<U>& other) : pool{other.pool} {}
+	[[nodiscard]] auto allocate(size_t n) -> T*;
+	auto deallocate(T* p, size_t n) -> void;
+	template <typename U> auto destroy(U* p) -> void;
+	template <typename U> auto operator==(const chunk_allocator<U>& other) const -> bool { return pool == other.pool; }
+};
+
+struct disk_cache {
+	std::mutex mutex;
+	std::filesystem::path dir;
+	std::unordered_map<std::string, std::weak_ptr<detail::disk_cache_file>> files;
+};
+
+// An evicted chunk which the audio thread might still be reading. It is
+// freed once the audio thread has left the process() call it was in when the
+// chunk was evicted.
+struct retired_chunk {
+	shptr<const chunk_data> data;
+	uint64_t audio_epoch = 0;
+};
+
+// The number of bytes of chunk data a streamer is holding. Gives them back
+// to the shared budget when destroyed. Whenever bytes are given back, the
+// other loaders using the budget try again in case they now fit.
+struct budget_usage {
+	detail::memory_budget* budget = nullptr;
+	// The loader's thread, or the pool it is on, for the budget to wake.
+	detail::loader_wakeup* wakeup = nullptr;
+	detail::pool* pool = nullptr;
+	size_t bytes = 0;
+	budget_usage() = default;
+	budget_usage(const budget_usage&) = delete;
+	auto operator=(const budget_usage&) -> budget_usage& = delete;
+	~budget_usage();
+};
+
+struct loader_state {
+	std::optional<ads::interleaved<float>> interleaved;
+	std::vector<shptr<const chunk_data>> chunks; // Indexed by chunk.
+	detail::chunk_cache* cache = nullptr;
+	shptr<detail::chunk_pool> chunk_pool;
+	shptr<detail::disk_cache_file> disk_cache_file;
+	std::string cache_identity; // Empty if the file has no identity, i.e. don't cache.
+	std::vector<detail::retired_chunk> retired;
+	std::optional<size_t> next_chunk = 0; // Only used for formats which can't random seek.
+	std::vector<afs::stream_seek_point> seek_index; // Indexed by chunk. Formats which can't random seek can jump to any chunk in here.
+	std::vector<size_t> approximate_chunks; // Chunks past the end of the seek index which were jumped to approximately.
+	std::optional<ads::frame_idx> stream_pos; // The next frame the stream will read, if it is known.
+	bool stream_approximate = false;          // The stream's position came from an approximate jump.
+	ads::frame_idx seek_pos;            // The last seek target the loader has seen.
+	std::chrono::steady_clock::time_point retry_at;                   // When to try again after load_next_chunk() was idle.
+	std::chrono::steady_clock::time_point playback_pos_requested_at; // When the oldest unanswered request for the playback position was made.
+	std::chrono::steady_clock::time_point seen_playback_pos_at;      // When the audio thread was asked for the position it last reported.
+	double seen_playback_pos = 0.0;
+	double playhead_speed    = 0.0; // Frames per second, as last measured, or 0 before the playhead has been seen moving.
+	std::chrono::steady_clock::duration stopped_wait{};             // How long to wait for the audio thread to start again.
+	size_t chunk_size    = 0;           // The same as the chunk directory's.
+	std::optional<size_t> end_chunk;
+	ads::frame_count total_frames_read;
+	detail::budget_usage usage;
+	size_t max_bytes     = 0; // 0 means no limit.
+	bool can_random_seek = true;
+	double SR            = 0.0;
+	afs::sample_format storage_format = afs::sample_format::float32;
+};
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread>
+struct loader {
+	uptr<Stream> stream;
+	detail::loader_state state;
+	detail::pool_registration pool_registration;
+	detail::loader_wakeup wakeup;
+	JThread thread;
+	JThread scan_thread; // Works out the length of an MP3 from its frame headers.
+	loader() = default;
+	loader(const loader&) = delete;
+	auto operator=(const loader&) -> loader& = delete;
+	~loader();
+};
+
+struct loader_options {
+	detail::pool* pool = nullptr;
+	detail::memory_budget* budget = nullptr;
+	size_t max_bytes = 0;
+	detail::chunk_cache* cache = nullptr;
+	detail::disk_cache* disk_cache = nullptr;
+	detail::chunk_pool* chunk_pool = nullptr;
+	std::string cache_identity = {};
+	std::filesystem::path map_path = {};
+	afs::sample_format chunk_format = afs::sample_format::float32;
+	size_t chunk_size         = 0;
+	size_t default_chunk_size = DEFAULT_CHUNK_SIZE;
+};
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread>
+struct impl {
+	detail::shared_safe shared;
+	detail::loader<Stream, JThread> loader;
+	uptr<detail::mapped_wav> wav; // If set, nothing is loaded.
+	detail::servo servo;
+	detail::snapshot snapshot;
+	detail::resampler resampler;
+};
+
+[[nodiscard]] static
+auto fn_seek(ads::frame_idx pos) {
+	return [pos](model x) {
+		x.target.seek_pos = pos;
+		return x;
+	};
+}
+
+[[nodiscard]] static
+auto make_initial_model(audiorw::header header) -> model {
+	model out;
+	out.header = header;
+	return out;
+}
+
+[[nodiscard]] static
+auto can_seek(const model& x) -> bool {
+	return x.header.frame_count.has_value();
+}
+
+
+[[nodiscard]] static
+auto get_estimated_frame_count(const model& x) -> ads::frame_count {
+	if (x.header.frame_count) {
+		return *x.header.frame_count;
+	}
+	return x.estimated_frame_count;
+}
+
+static
+auto write_snapshot(ez::nort_t, detail::snapshot_slot* slot, const model& x) -> void {
+	const auto seq = slot->seq.load(std::memory_order_relaxed);
+	slot->seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot->channel_count.store(x.header.channel_count.value, std::memory_order_relaxed);
+	slot->SR.store(static_cast<double>(x.header.SR), std::memory_order_relaxed);
+	slot->estimated_frame_count.store(get_estimated_frame_count(x).value, std::memory_order_relaxed);
+	slot->frame_count_known.store(x.header.frame_count.has_value(), std::memory_order_relaxed);
+	slot->seek_pos.store(x.target.seek_pos.value, std::memory_order_relaxed);
+	slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+static
+auto publish(ez::nort_t th, detail::shared_safe* shared, auto fn) -> model {
+	auto lock = std::unique_lock{shared->published.mutex};
+	auto out  = shared->model.update_publish(th, fn);
+	write_snapshot(th, &shared->published, out);
+	shared->atomics.model_version.fetch_add(1, std::memory_order_release);
+	return out;
+}
+
+static
+auto publish(ez::nort_t th, detail::shared_safe* shared, model x) -> void {
+	auto lock = std::unique_lock{shared->published.mutex};
+	write_snapshot(th, &shared->published, x);
+	shared->model.set_publish(th, std::move(x));
+	shared->atomics.model_version.fetch_add(1, std::memory_order_release);
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto can_seek(ez::nort_t th, const impl<Stream, JThread>* x) -> bool {
+	return can_seek(x->shared.model.read(th));
+}
+
+[[nodiscard]] static
+auto get_chunk_beg(size_t chunk_size, size_t chunk_idx) -> ads::frame_idx {
+	return ads::frame_idx{static_cast<int64_t>(chunk_size)} * chunk_idx;
+}
+
+[[nodiscard]] static
+auto get_chunk_idx(size_t chunk_size, double pos) -> size_t {
+	return static_cast<size_t>(std::floor(pos / static_cast<double>(chunk_size)));
+}
+
+[[nodiscard]] static
+auto get_chunk_idx(size_t chunk_size, ads::frame_idx fr) -> size_t {
+	return static_cast<size_t>(fr.value / static_cast<int64_t>(chunk_size));
+}
+
+[[nodiscard]] static
+auto get_chunk_count(size_t chunk_size, ads::frame_count frame_count) -> size_t {
+	return static_cast<size_t>((frame_count.value + chunk_size - 1) / chunk_size);
+}
+
+[[nodiscard]] static
+auto get_local_chunk_frame(size_t chunk_size, ads::frame_idx fr) -> ads::frame_idx {
+	return {fr.value % static_cast<int64_t>(chunk_size)};
+}
+
+// Picks the chunk size for a stream. A chunk_size the streamer was given
+// is used as it is, otherwise one is picked starting from
+// default_chunk_size. A file shorter than a chunk gets a single chunk just
+// big enough to hold it, and a very long file gets bigger chunks so that
+// there aren't so many of them. The size only depends on the header so
+// that it is the same every time the file is opened, which the caches rely
+// on.
+[[nodiscard]] static
+auto choose_chunk_size(const audiorw::header& header, size_t chunk_size, size_t default_chunk_size) -> size_t {
+	static constexpr auto MIN_CHUNK_SIZE   = size_t{1024};
+	static constexpr auto MAX_CHUNK_COUNT  = size_t{2048};
+	static constexpr auto MAX_CHUNK_GROWTH = size_t{16};
+	if (chunk_size > 0) {
+		return chunk_size;
+	}
+	if (!header.frame_count) {
+		return default_chunk_size;
+	}
+	const auto frame_count = static_cast<size_t>(header.frame_count->value);
+	if (frame_count < default_chunk_size) {
+		return std::max(std::bit_ceil(frame_count), std::min(MIN_CHUNK_SIZE, default_chunk_size));
+	}
+	if (frame_count / default_chunk_size > MAX_CHUNK_COUNT) {
+		return std::min(std::bit_ceil(frame_count / MAX_CHUNK_COUNT), default_chunk_size * MAX_CHUNK_GROWTH);
+	}
+	return default_chunk_size;
+}
+
+[[nodiscard]] static auto get_isa() -> isa;
+
+[[nodiscard]] static constexpr
+auto get_bytes_per_sample(afs::sample_format format) -> size_t {
+	switch (format) {
+		case afs::sample_format::uint8:   { return 1; }
+		case afs::sample_format::int16:   { return 2; }
+		case afs::sample_format::int24:   { return 3; }
+		case afs::sample_format::int32:   { return 4; }
+		case afs::sample_format::float16: { return 2; }
+		case afs::sample_format::float32: { return 4; }
+		default:                          { return 4; }
+	}
+}
+
+// Calls fn with the sample format as a compile-time constant.
+static
+auto with_sample_format(afs::sample_format format, auto fn) -> void {
+	using enum afs::sample_format;
+	switch (format) {
+		case uint8:   { return fn(std::integral_constant<afs::sample_format, uint8>{}); }
+		case int16:   { return fn(std::integral_constant<afs::sample_format, int16>{}); }
+		case int24:   { return fn(std::integral_constant<afs::sample_format, int24>{}); }
+		case int32:   { return fn(std::integral_constant<afs::sample_format, int32>{}); }
+		case float16: { return fn(std::integral_constant<afs::sample_format, float16>{}); }
+		case float32: { return fn(std::integral_constant<afs::sample_format, float32>{}); }
+	}
+}
+
+// IEEE half precision conversions with round-to-nearest-even, after Fabian
+// Giesen's branchy versions.
+[[nodiscard]] static
+auto float_to_half(float x) -> uint16_t {
+	static constexpr auto F16_MAX      = uint32_t{(127 + 16) << 23};
+	static constexpr auto F32_INFINITY = uint32_t{255 << 23};
+	static constexpr auto DENORM_MAGIC = uint32_t{((127 - 15) + (23 - 10) + 1) << 23};
+	auto bits       = std::bit_cast<uint32_t>(x);
+	const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	bits &= 0x7FFFFFFF;
+	if (bits >= F16_MAX) {
+		return sign | (bits > F32_INFINITY ? 0x7E00 : 0x7C00);
+	}
+	if (bits < (113 << 23)) {
+		// Subnormal or zero. Let the float addition do the rounding.
+		const auto f = std::bit_cast<float>(bits) + std::bit_cast<float>(DENORM_MAGIC);
+		return sign | static_cast<uint16_t>(std::bit_cast<uint32_t>(f) - DENORM_MAGIC);
+	}
+	const auto mantissa_odd = (bits >> 13) & 1;
+	bits += (static_cast<uint32_t>(15 - 127) << 23) + 0xFFF + mantissa_odd;
+	return sign | static_cast<uint16_t>(bits >> 13);
+}
+
+[[nodiscard]] static
+auto half_to_float(uint16_t x) -> float {
+	static constexpr auto SHIFTED_EXP = uint32_t{0x7C00} << 13;
+	auto bits      = (uint32_t{x} & 0x7FFF) << 13;
+	const auto exp = bits & SHIFTED_EXP;
+	bits += (127 - 15) << 23;
+	if (exp == SHIFTED_EXP) {
+		// Infinity or NaN.
+		bits += (128 - 16) << 23;
+	}
+	else if (exp == 0) {
+		// Zero or subnormal.
+		bits += 1 << 23;
+		bits = std::bit_cast<uint32_t>(std::bit_cast<float>(bits) - std::bit_cast<float>(uint32_t{113 << 23}));
+	}
+	return std::bit_cast<float>(bits | (uint32_t{x} & 0x8000) << 16);
+}
+
+// Samples are always little-endian, and so is everything we run on.
+template <afs::sample_format FORMAT> [[nodiscard]] static
+auto read_sample(const std::byte* p) -> float {
+	using enum afs::sample_format;
+	if constexpr (FORMAT == uint8) {
+		return (static_cast<float>(std::to_integer<uint8_t>(*p)) - 128.0f) * (1.0f / 128.0f);
+	}
+	if constexpr (FORMAT == int16) {
+		auto x = int16_t{};
+		std::memcpy(&x, p, sizeof(x));
+		return static_cast<float>(x) * (1.0f / 32768.0f);
+	}
+	if constexpr (FORMAT == int24) {
+		const auto x = static_cast<int32_t>(
+			(std::to_integer<uint32_t>(p[0]) << 8) |
+			(std::to_integer<uint32_t>(p[1]) << 16) |
+			(std::to_integer<uint32_t>(p[2]) << 24)) >> 8;
+		return static_cast<float>(x) * (1.0f / 8388608.0f);
+	}
+	if constexpr (FORMAT == int32) {
+		auto x = int32_t{};
+		std::memcpy(&x, p, sizeof(x));
+		return static_cast<float>(x) * (1.0f / 2147483648.0f);
+	}
+	if constexpr (FORMAT == float16) {
+		auto x = uint16_t{};
+		std::memcpy(&x, p, sizeof(x));
+		return half_to_float(x);
+	}
+	if constexpr (FORMAT == float32) {
+		auto x = 0.0f;
+		std::memcpy(&x, p, sizeof(x));
+		return x;
+	}
+}
+
+template <afs::sample_format FORMAT> static
+auto write_sample(float x, std::byte* p) -> void {
+	using enum afs::sample_format;
+	if constexpr (FORMAT == uint8) {
+		*p = static_cast<std::byte>(std::clamp(std::nearbyint(x * 128.0f) + 128.0f, 0.0f, 255.0f));
+	}
+	if constexpr (FORMAT == int16) {
+		const auto v = static_cast<int16_t>(std::clamp(std::nearbyint(x * 32768.0f), -32768.0f, 32767.0f));
+		std::memcpy(p, &v, sizeof(v));
+	}
+	if constexpr (FORMAT == int24) {
+		const auto v = static_cast<uint32_t>(static_cast<int32_t>(std::clamp(std::nearbyint(x * 8388608.0f), -8388608.0f, 8388607.0f)));
+		p[0] = static_cast<std::byte>(v);
+		p[1] = static_cast<std::byte>(v >> 8);
+		p[2] = static_cast<std::byte>(v >> 16);
+	}
+	if constexpr (FORMAT == int32) {
+		const auto v = static_cast<int32_t>(std::clamp(std::nearbyint(x * 2147483648.0), -2147483648.0, 2147483647.0));
+		std::memcpy(p, &v, sizeof(v));
+	}
+	if constexpr (FORMAT == float16) {
+		const auto v = float_to_half(x);
+		std::memcpy(p, &v, sizeof(v));
+	}
+	if constexpr (FORMAT == float32) {
+		std::memcpy(p, &x, sizeof(x));
+	}
+}
+
+// Converts frame_count samples, stride bytes apart, to float.
+static
+auto read_samples(afs::sample_format format, const std::byte* in, size_t stride, size_t frame_count, float* out) -> void {
+	with_sample_format(format, [=](auto format) {
+		static constexpr auto FORMAT = decltype(format)::value;
+		if (FORMAT == afs::sample_format::float32 && stride == sizeof(float)) {
+			std::memcpy(out, in, frame_count * sizeof(float));
+			return;
+		}
+		for (size_t i = 0; i < frame_count; i++) {
+			out[i] = read_sample<FORMAT>(in + i * stride);
+		}
+	});
+}
+
+// Converts frame_count floats, stride floats apart, to the given format.
+static
+auto write_samples(afs::sample_format format, const float* in, size_t stride, size_t frame_count, std::byte* out) -> void {
+	with_sample_format(format, [=](auto format) {
+		static constexpr auto FORMAT = decltype(format)::value;
+		static constexpr auto BYTES  = get_bytes_per_sample(FORMAT);
+		for (size_t i = 0; i < frame_count; i++) {
+			write_sample<FORMAT>(in[i * stride], out + i * BYTES);
+		}
+	});
+}
+
+#if AFS_X86
+// The deinterleave kernels below split a block of interleaved frames into
+// one vector per channel and store each vector in the chunk's format. They
+// return how many frames they did, which is always a whole number of
+// blocks, and leave the rest to write_samples(). Channel counts of four or
+// more are transposed four channels at a time. With six channels the second
+// group overlaps the first by two channels.
+template <afs::sample_format FORMAT> static
+auto store_samples_sse(__m128 x, std::byte* out) -> void {
+	if constexpr (FORMAT == afs::sample_format::float32) {
+		_mm_storeu_ps(reinterpret_cast<float*>(out), x);
+	}
+	if constexpr (FORMAT == afs::sample_format::int16) {
+		const auto v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(32768.0f)), _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f));
+		const auto i = _mm_cvtps_epi32(v);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(i, i));
+	}
+}
+
+template <afs::sample_format FORMAT, size_t CH> static
+auto deinterleave_sse(const float* in, size_t frame_count, std::byte* out, size_t channel_stride) -> size_t {
+	static constexpr auto BYTES = get_bytes_per_sample(FORMAT);
+	auto i = size_t{0};
+	for (; i + 4 <= frame_count; i += 4) {
+		const auto f = in + i * CH;
+		const auto o = out + i * BYTES;
+		if constexpr (CH == 1) {
+			store_samples_sse<FORMAT>(_mm_loadu_ps(f), o);
+		}
+		else if constexpr (CH == 2) {
+			const auto a = _mm_loadu_ps(f);
+			const auto b = _mm_loadu_ps(f + 4);
+			store_samples_sse<FORMAT>(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), o);
+			store_samples_sse<FORMAT>(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), o + channel_stride);
+		}
+		else {
+			for (size_t c = 0; c < CH; c += 4) {
+				const auto c0 = std::min(c, CH - 4);
+				auto r0 = _mm_loadu_ps(f + c0);
+				auto r1 = _mm_loadu_ps(f + c0 + CH);
+				auto r2 = _mm_loadu_ps(f + c0 + CH * 2);
+				auto r3 = _mm_loadu_ps(f + c0 + CH * 3);
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				store_samples_sse<FORMAT>(r0, o + (c0 + 0) * channel_stride);
+				store_samples_sse<FORMAT>(r1, o + (c0 + 1) * channel_stride);
+				store_samples_sse<FORMAT>(r2, o + (c0 + 2) * channel_stride);
+				store_samples_sse<FORMAT>(r3, o + (c0 + 3) * channel_stride);
+			}
+		}
+	}
+	return i;
+}
+
+template <afs::sample_format FORMAT> AFS_TARGET_AVX2 static
+auto store_samples_avx2(__m256 x, std::byte* out) -> void {
+	if constexpr (FORMAT == afs::sample_format::float32) {
+		_mm256_storeu_ps(reinterpret_cast<float*>(out), x);
+	}
+	if constexpr (FORMAT == afs::sample_format::int16) {
+		const auto v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(x, _mm256_set1_ps(32768.0f)), _mm256_set1_ps(-32768.0f)), _mm256_set1_ps(32767.0f));
+		const auto i = _mm256_cvtps_epi32(v);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+	}
+}
+
+// Frames 0-3 go in the low lane and frames 4-7 in the high lane, so that
+// the usual 4x4 transpose works on both lanes at once.
+[[nodiscard]] AFS_TARGET_AVX2 static
+auto load_frame_pair_avx2(const float* in, size_t distance) -> __m256 {
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(in)), _mm_loadu_ps(in + distance), 1);
+}
+
+template <afs::sample_format FORMAT, size_t CH> AFS_TARGET_AVX2 static
+auto deinterleave_avx2(const float* in, size_t frame_count, std::byte* out, size_t channel_stride) -> size_t {
+	static constexpr auto BYTES = get_bytes_per_sample(FORMAT);
+	auto i = size_t{0};
+	for (; i + 8 <= frame_count; i += 8) {
+		const auto f = in + i * CH;
+		const auto o = out + i * BYTES;
+		if constexpr (CH == 1) {
+			store_samples_avx2<FORMAT>(_mm256_loadu_ps(f), o);
+		}
+		else if constexpr (CH == 2) {
+			const auto a = _mm256_loadu_ps(f);
+			const auto b = _mm256_loadu_ps(f + 8);
+			const auto L = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			const auto R = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			store_samples_avx2<FORMAT>(_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(L), _MM_SHUFFLE(3, 1, 2, 0))), o);
+			store_samples_avx2<FORMAT>(_mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(R), _MM_SHUFFLE(3, 1, 2, 0))), o + channel_stride);
+		}
+		else {
+			for (size_t c = 0; c < CH; c += 4) {
+				const auto c0 = std::min(c, CH - 4);
+				const auto r0 = load_frame_pair_avx2(f + c0, CH * 4);
+				const auto r1 = load_frame_pair_avx2(f + c0 + CH, CH * 4);
+				const auto r2 = load_frame_pair_avx2(f + c0 + CH * 2, CH * 4);
+				const auto r3 = load_frame_pair_avx2(f + c0 + CH * 3, CH * 4);
+				const auto t0 = _mm256_unpacklo_ps(r0, r1);
+				const auto t1 = _mm256_unpacklo_ps(r2, r3);
+				const auto t2 = _mm256_unpackhi_ps(r0, r1);
+				const auto t3 = _mm256_unpackhi_ps(r2, r3);
+				store_samples_avx2<FORMAT>(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0)), o + (c0 + 0) * channel_stride);
+				store_samples_avx2<FORMAT>(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2)), o + (c0 + 1) * channel_stride);
+				store_samples_avx2<FORMAT>(_mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0)), o + (c0 + 2) * channel_stride);
+				store_samples_avx2<FORMAT>(_mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2)), o + (c0 + 3) * channel_stride);
+			}
+		}
+	}
+	return i;
+}
+
+template <afs::sample_format FORMAT, size_t CH> static
+auto deinterleave_simd(isa target_isa, const float* in, size_t frame_count, std::byte* out, size_t channel_stride) -> size_t {
+	// With eight float channels the stores, not the shuffles, are the limit,
+	// and the narrower SSE stores measured faster.
+	if constexpr (FORMAT == afs::sample_format::float32 && CH == 8) {
+		if (target_isa == isa::avx2) { target_isa = isa::sse; }
+	}
+	switch (target_isa) {
+		case isa::avx2: { return deinterleave_avx2<FORMAT, CH>(in, frame_count, out, channel_stride); }
+		case isa::sse:  { return deinterleave_sse<FORMAT, CH>(in, frame_count, out, channel_stride); }
+		default:        { return 0; }
+	}
+}
+
+template <afs::sample_format FORMAT> static
+auto deinterleave_simd(isa target_isa, const float* in, size_t channel_count, size_t frame_count, std::byte* out, size_t channel_stride) -> size_t {
+	switch (channel_count) {
+		case 1:  { return deinterleave_simd<FORMAT, 1>(target_isa, in, frame_count, out, channel_stride); }
+		case 2:  { return deinterleave_simd<FORMAT, 2>(target_isa, in, frame_count, out, channel_stride); }
+		case 4:  { return deinterleave_simd<FORMAT, 4>(target_isa, in, frame_count, out, channel_stride); }
+		case 6:  { return deinterleave_simd<FORMAT, 6>(target_isa, in, frame_count, out, channel_stride); }
+		case 8:  { return deinterleave_simd<FORMAT, 8>(target_isa, in, frame_count, out, channel_stride); }
+		default: { return 0; }
+	}
+}
+#endif
+
+// Converts frame_count interleaved frames to the given format, one channel
+// after another, channel_stride bytes apart. Common channel counts and
+// formats have SIMD kernels for the given instruction set.
+static
+auto deinterleave_samples(isa target_isa, afs::sample_format format, const float* in, ads::channel_count channel_count, size_t frame_count, std::byte* out, size_t channel_stride) -> void {
+	const auto ch_count = static_cast<size_t>(channel_count.value);
+	auto done = size_t{0};
+#if AFS_X86
+	switch (format) {
+		case afs::sample_format::float32: { done = deinterleave_simd<afs::sample_format::float32>(target_isa, in, ch_count, frame_count, out, channel_stride); break; }
+		case afs::sample_format::int16:   { done = deinterleave_simd<afs::sample_format::int16>(target_isa, in, ch_count, frame_count, out, channel_stride); break; }
+		default:                          { break; }
+	}
+#endif
+	const auto bytes_per_sample = get_bytes_per_sample(format);
+	for (size_t ch = 0; ch < ch_count; ch++) {
+		write_samples(format, in + done * ch_count + ch, ch_count, frame_count - done, out + ch * channel_stride + done * bytes_per_sample);
+	}
+}
+
+[[nodiscard]] static
+auto get_chunk_data_bytes(afs::sample_format format, ads::channel_count channel_count, size_t frame_count) -> size_t {
+	return frame_count * channel_count.value * get_bytes_per_sample(format);
+}
+
+[[nodiscard]] static
+auto take_buffer(ez::nort_t, detail::chunk_pool* pool, size_t bytes) -> std::vector<std::byte> {
+	auto lock = std::unique_lock{pool->mutex};
+	const auto pos = pool->buffers.find(bytes);
+	if (pos == pool->buffers.end() || pos->second.empty()) {
+		// Allocate outside the lock.
+		lock.unlock();
+		return std::vector<std::byte>(bytes);
+	}
+	auto out = std::move(pos->second.back());
+	pos->second.pop_back();
+	pool->bytes -= bytes;
+	return out;
+}
+
+static
+auto give_back_buffer(ez::nort_t, detail::chunk_pool* pool, std::vector<std::byte> buffer) -> void {
+	const auto bytes = buffer.size();
+	auto lock = std::unique_lock{pool->mutex};
+	if (bytes == 0 || pool->bytes + bytes > pool->max_bytes) {
+		// Free outside the lock.
+		lock.unlock();
+		return;
+	}
+	pool->buffers[bytes].push_back(std::move(buffer));
+	pool->bytes += bytes;
+}
+
+[[nodiscard]] static
+auto take_block(ez::nort_t, detail::chunk_pool* pool, size_t bytes) -> void* {
+	auto lock = std::unique_lock{pool->mutex};
+	const auto pos = pool->blocks.find(bytes);
+	if (pos == pool->blocks.end() || pos->second.empty()) {
+		lock.unlock();
+		return ::operator new(bytes);
+	}
+	const auto out = pos->second.back();
+	pos->second.pop_back();
+	pool->bytes -= bytes;
+	return out;
+}
+
+static
+auto give_back_block(ez::nort_t, detail::chunk_pool* pool, void* block, size_t bytes) -> void {
+	auto lock = std::unique_lock{pool->mutex};
+	if (pool->bytes + bytes > pool->max_bytes) {
+		lock.unlock();
+		::operator delete(block);
+		return;
+	}
+	pool->blocks[bytes].push_back(block);
+	pool->bytes += bytes;
+}
+
+inline
+chunk_pool::~chunk_pool() {
+	for (const auto& [bytes, list] : blocks) {
+		for (const auto block : list) {
+			::operator delete(block);
+		}
+	}
+}
+
+template <typename T>
+auto chunk_allocator<T>::allocate(size_t n) -> T* {
+	static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	return static_cast<T*>(take_block(ez::nort, pool.get(), n * sizeof(T)));
+}
+
+template <typename T>
+auto chunk_allocator<T>::deallocate(T* p, size_t n) -> void {
+	give_back_block(ez::nort, pool.get(), p, n * sizeof(T));
+}
+
+template <typename T> template <typename U>
+auto chunk_allocator<T>::destroy(U* p) -> void {
+	if constexpr (std::is_same_v<U, detail::chunk_data>) {
+		give_back_buffer(ez::nort, pool.get(), std::move(p->bytes));
+	}
+	p->~U();
+}
+
+// The chunk and its bytes come from the pool if there is one, and go back
+// to it when the last owner of the chunk lets go of it. Recycled bytes
+// aren't cleared, so every frame up to frame_count has to be written before
+// the chunk is played. The chunk holds on to the pool until then.
+[[nodiscard]] static
+auto make_chunk_data(ez::nort_t th, detail::chunk_pool* pool, afs::sample_format format, ads::channel_count channel_count, size_t frame_count) -> shptr<detail::chunk_data> {
+	const auto bytes = get_chunk_data_bytes(format, channel_count, frame_count);
+	auto out = shptr<detail::chunk_data>{};
+	if (pool) {
+		out = std::allocate_shared<detail::chunk_data>(detail::chunk_allocator<detail::chunk_data>{pool->shared_from_this()});
+		out->bytes = take_buffer(th, pool, bytes);
+	}
+	else {
+		out = make_shptr<detail::chunk_data>();
+		out->bytes.resize(bytes);
+	}
+	out->format      = format;
+	out->frame_count = frame_count;
+	out->ready_frames.store(frame_count, std::memory_order_relaxed);
+	return out;
+}
+
+// Shared by every chunk which is entirely digital silence.
+[[nodiscard]] static
+auto get_silent_chunk() -> const shptr<const detail::chunk_data>& {
+	static const auto out = [] {
+		auto x = make_shptr<detail::chunk_data>();
+		x->silent = true;
+		return shptr<const detail::chunk_data>{std::move(x)};
+	}();
+	return out;
+}
+
+[[nodiscard]] static
+auto is_silent(std::span<const float> frames) -> bool {
+	return std::all_of(frames.begin(), frames.end(), [](float x) { return x == 0.0f; });
+}
+
+[[nodiscard]] static
+auto get_ready_range(const chunk_data& x) -> ready_range {
+	const auto beg = x.ready_beg.load(std::memory_order_acquire);
+	const auto end = x.ready_frames.load(std::memory_order_acquire);
+	return {std::min(beg, x.frame_count), std::min(end, x.frame_count)};
+}
+
+[[nodiscard]] static
+auto get_channel_data(const chunk_data& x, ads::channel_idx ch) -> const std::byte* {
+	return x.bytes.data() + ch.value * x.frame_count * get_bytes_per_sample(x.format);
+}
+
+[[nodiscard]] static
+auto get_channel_data(chunk_data* x, ads::channel_idx ch) -> std::byte* {
+	return x->bytes.data() + ch.value * x->frame_count * get_bytes_per_sample(x->format);
+}
+
+// Fills frames [beg, end) of a chunk with silence.
+static
+auto clear_frames(ez::nort_t, detail::chunk_data* x, ads::channel_count channel_count, size_t beg, size_t end) -> void {
+	const auto bytes_per_sample = get_bytes_per_sample(x->format);
+	const auto silence          = x->format == afs::sample_format::uint8 ? 0x80 : 0;
+	for (ads::channel_idx ch; ch < channel_count; ch++) {
+		std::memset(get_channel_data(x, ch) + beg * bytes_per_sample, silence, (end - beg) * bytes_per_sample);
+	}
+}
+
+// A copy of the first frame_count frames of a chunk.
+[[nodiscard]] static
+auto copy_chunk_data(ez::nort_t th, detail::chunk_pool* pool, const detail::chunk_data& x, ads::channel_count channel_count, size_t frame_count) -> shptr<detail::chunk_data> {
+	auto out = make_chunk_data(th, pool, x.format, channel_count, frame_count);
+	const auto bytes = frame_count * get_bytes_per_sample(x.format);
+	for (ads::channel_idx ch; ch < channel_count; ch++) {
+		std::memcpy(get_channel_data(out.get(), ch), get_channel_data(x, ch), bytes);
+	}
+	return out;
+}
+
+static
+auto reserve_page(ez::nort_t, detail::chunk_dir* dir, size_t page_idx) -> detail::chunk_dir::page* {
+	if (!dir->page_storage[page_idx]) {
+		dir->page_storage[page_idx] = make_uptr<detail::chunk_dir::page>();
+		dir->pages[page_idx].store(dir->page_storage[page_idx].get(), std::memory_order_release);
+	}
+	return dir->page_storage[page_idx].get();
+}
+
+static
+auto reserve_chunks(ez::nort_t th, detail::chunk_dir* dir, size_t chunk_count) -> void {
+	const auto page_count = std::min((chunk_count + detail::chunk_dir::PAGE_SIZE - 1) / detail::chunk_dir::PAGE_SIZE, detail::chunk_dir::MAX_PAGES);
+	for (size_t i = 0; i < page_count; i++) {
+		reserve_page(th, dir, i);
+	}
+}
+
+static
+auto set_chunk(ez::nort_t th, detail::chunk_dir* dir, size_t chunk_idx, const chunk_data* data) -> void {
+	const auto page_idx = chunk_idx / detail::chunk_dir::PAGE_SIZE;
+	if (page_idx >= detail::chunk_dir::MAX_PAGES) {
+		// Too many chunks to index. The chunk will just never be played.
+		return;
+	}
+	const auto page = reserve_page(th, dir, page_idx);
+	// seq_cst so that an eviction is ordered before the loader reads the audio epoch.
+	(*page)[chunk_idx % detail::chunk_dir::PAGE_SIZE].store(data, std::memory_order_seq_cst);
+}
+
+[[nodiscard]] static
+auto find_chunk(ez::audio_t, const detail::chunk_dir& dir, size_t chunk_idx) -> const chunk_data* {
+	const auto page_idx = chunk_idx / detail::chunk_dir::PAGE_SIZE;
+	if (page_idx >= detail::chunk_dir::MAX_PAGES) {
+		return nullptr;
+	}
+	if (const auto page = dir.pages[page_idx].load(std::memory_order_acquire)) {
+		// seq_cst so that this is ordered after the audio epoch is incremented.
+		return (*page)[chunk_idx % detail::chunk_dir::PAGE_SIZE].load(std::memory_order_seq_cst);
+	}
+	return nullptr;
+}
+
+[[nodiscard]] static
+auto get_word_count(const detail::chunk_bitmap& x) -> size_t {
+	return (x.size.load(std::memory_order_acquire) + 63) / 64;
+}
+
+[[nodiscard]] static
+auto get_word(const detail::chunk_bitmap& x, size_t word_idx) -> uint64_t {
+	if (const auto page = x.pages[word_idx / detail::chunk_bitmap::PAGE_WORDS].load(std::memory_order_acquire)) {
+		return (*page)[word_idx % detail::chunk_bitmap::PAGE_WORDS].load(std::memory_order_acquire);
+	}
+	return 0;
+}
+
+static
+auto set_bit(ez::nort_t, detail::chunk_bitmap* x, size_t idx) -> void {
+	if (idx >= detail::chunk_bitmap::CAPACITY) {
+		return;
+	}
+	const auto word_idx = idx / 64;
+	const auto page_idx = word_idx / detail::chunk_bitmap::PAGE_WORDS;
+	if (!x->page_storage[page_idx]) {
+		x->page_storage[page_idx] = make_uptr<detail::chunk_bitmap::page>();
+		x->pages[page_idx].store(x->page_storage[page_idx].get(), std::memory_order_release);
+	}
+	(*x->page_storage[page_idx])[word_idx % detail::chunk_bitmap::PAGE_WORDS].fetch_or(uint64_t{1} << (idx % 64), std::memory_order_release);
+	if (idx >= x->size.load(std::memory_order_relaxed)) {
+		x->size.store(idx + 1, std::memory_order_release);
+	}
+}
+
+static
+auto clear_bit(ez::nort_t, detail::chunk_bitmap* x, size_t idx) -> void {
+	if (idx >= detail::chunk_bitmap::CAPACITY) {
+		return;
+	}
+	const auto word_idx = idx / 64;
+	if (const auto& page = x->page_storage[word_idx / detail::chunk_bitmap::PAGE_WORDS]) {
+		(*page)[word_idx % detail::chunk_bitmap::PAGE_WORDS].fetch_and(~(uint64_t{1} << (idx % 64)), std::memory_order_release);
+	}
+}
+
+[[nodiscard]] static
+auto is_bit_set(const detail::chunk_bitmap& x, size_t idx) -> bool {
+	if (idx >= detail::chunk_bitmap::CAPACITY) {
+		return false;
+	}
+	return (get_word(x, idx / 64) >> (idx % 64)) & 1;
+}
+
+// Returns the index of the first bit in [beg, end) which is equal to VALUE,
+// if there is one.
+template <bool VALUE> [[nodiscard]] static
+auto find_first(const detail::chunk_bitmap& x, size_t beg, size_t end) -> std::optional<size_t> {
+	end = std::min(end, detail::chunk_bitmap::CAPACITY);
+	if (beg >= end) {
+		return std::nullopt;
+	}
+	const auto word_count = get_word_count(x);
+	auto word_idx = beg / 64;
+	auto mask     = ~uint64_t{0} << (beg % 64);
+	for (; word_idx < word_count; word_idx++) {
+		const auto word = get_word(x, word_idx);
+		if (const auto bits = (VALUE ? word : ~word) & mask) {
+			const auto idx = word_idx * 64 + static_cast<size_t>(std::countr_zero(bits));
+			if (idx < end) { return idx; }
+			else           { return std::nullopt; }
+		}
+		mask = ~uint64_t{0};
+	}
+	if (VALUE) {
+		return std::nullopt;
+	}
+	// Everything past the end of the bitmap is zero.
+	const auto idx = std::max(beg, word_count * 64);
+	if (idx < end) { return idx; }
+	else           { return std::nullopt; }
+}
+
+// Returns the index of the last bit in [beg, end) which is equal to VALUE,
+// if there is one.
+template <bool VALUE> [[nodiscard]] static
+auto find_last(const detail::chunk_bitmap& x, size_t beg, size_t end) -> std::optional<size_t> {
+	end = std::min(end, detail::chunk_bitmap::CAPACITY);
+	if (beg >= end) {
+		return std::nullopt;
+	}
+	const auto bitmap_end = get_word_count(x) * 64;
+	if (end > bitmap_end) {
+		// Everything past the end of the bitmap is zero.
+		if (!VALUE)            { return end - 1; }
+		if (beg >= bitmap_end) { return std::nullopt; }
+		end = bitmap_end;
+	}
+	auto word_idx = (end - 1) / 64;
+	auto mask     = ~uint64_t{0} >> (63 - (end - 1) % 64);
+	for (;;) {
+		if (word_idx == beg / 64) {
+			mask &= ~uint64_t{0} << (beg % 64);
+		}
+		const auto word = get_word(x, word_idx);
+		if (const auto bits = (VALUE ? word : ~word) & mask) {
+			return word_idx * 64 + 63 - static_cast<size_t>(std::countl_zero(bits));
+		}
+		if (word_idx == beg / 64) {
+			return std::nullopt;
+		}
+		word_idx--;
+		mask = ~uint64_t{0};
+	}
+}
+
+static
+auto get_chunk_bitmap(ez::nort_t, const detail::chunk_bitmap& x, std::vector<uint64_t>* out) -> size_t {
+	const auto size = x.size.load(std::memory_order_acquire);
+	out->resize((size + 63) / 64);
+	for (size_t i = 0; i < out->size(); i++) {
+		(*out)[i] = get_word(x, i);
+	}
+	return size;
+}
+
+[[nodiscard]] static
+auto get_next_chunk_to_load_forward(size_t chunk_just_loaded, std::optional<size_t> end_chunk) -> std::optional<size_t> {
+	if (end_chunk && chunk_just_loaded == *end_chunk) {
+		return std::nullopt;
+	}
+	return chunk_just_loaded + 1;
+}
+
+// Where the loader takes the playhead to be. If the audio thread hasn't
+// gone to the last seek target the loader has seen yet, the playhead is
+// about to be there.
+[[nodiscard]] static
+auto get_playhead_pos(const detail::shared_safe& shared, const detail::loader_state& state) -> double {
+	if (shared.atomics.reported_playback_beg.load(std::memory_order_acquire) != state.seek_pos.value) {
+		return static_cast<double>(state.seek_pos.value);
+	}
+	return shared.atomics.reported_playback_pos.load(std::memory_order_relaxed);
+}
+
+[[nodiscard]] static
+auto get_playback_chunk(const detail::shared_safe& shared, const detail::loader_state& state) -> size_t {
+	return get_chunk_idx(state.chunk_size, get_playhead_pos(shared, state));
+}
+
+[[nodiscard]] static
+auto is_memory_limited(const detail::loader_state& state) -> bool {
+	return state.max_bytes > 0 || state.usage.budget;
+}
+
+// How far a chunk is from the playhead when deciding what to load or evict.
+// Chunks behind the playhead count double because playback goes forwards.
+[[nodiscard]] static
+auto get_distance_from_playhead(size_t playback_chunk, size_t chunk_idx) -> size_t {
+	if (chunk_idx >= playback_chunk) { return chunk_idx - playback_chunk; }
+	else                             { return 2 * (playback_chunk - chunk_idx); }
+}
+
+[[nodiscard]] static
+auto get_nearest(size_t playback_chunk, std::optional<size_t> a, std::optional<size_t> b) -> std::optional<size_t> {
+	if (!a) { return b; }
+	if (!b) { return a; }
+	return get_distance_from_playhead(playback_chunk, *a) <= get_distance_from_playhead(playback_chunk, *b) ? a : b;
+}
+
+[[nodiscard]] static
+auto get_farthest(size_t playback_chunk, std::optional<size_t> a, std::optional<size_t> b) -> std::optional<size_t> {
+	if (!a) { return b; }
+	if (!b) { return a; }
+	return get_distance_from_playhead(playback_chunk, *a) >= get_distance_from_playhead(playback_chunk, *b) ? a : b;
+}
+
+// Whether a chunk could be loaded again after being evicted.
+[[nodiscard]] static
+auto can_reload(const detail::loader_state& state) -> bool {
+	return state.can_random_seek || !state.seek_index.empty();
+}
+
+// Chunks past the end of the seek index haven't been reached yet, but the
+// last chunk in it can always be loaded, so the index grows as chunks are
+// loaded.
+[[nodiscard]] static
+auto get_loadable_chunk_count(const detail::loader_state& state) -> size_t {
+	const auto chunk_count = state.end_chunk ? *state.end_chunk + 1 : std::numeric_limits<size_t>::max();
+	if (state.can_random_seek) {
+		return chunk_count;
+	}
+	return std::min(chunk_count, state.seek_index.size());
+}
+
+[[nodiscard]] static
+auto get_next_chunk_to_load_random(const detail::shared_safe& shared, const detail::loader_state& state) -> std::optional<size_t> {
+	const auto& loaded        = shared.loaded;
+	const auto playback_chunk = get_playback_chunk(shared, state);
+	const auto chunk_count    = get_loadable_chunk_count(state);
+	const auto ahead          = find_first<false>(loaded, playback_chunk, chunk_count);
+	if (is_memory_limited(state)) {
+		// Only the chunks nearest the playhead will fit so fill in around it.
+		return get_nearest(playback_chunk, ahead, find_last<false>(loaded, 0, std::min(playback_chunk, chunk_count)));
+	}
+	if (ahead) {
+		return ahead;
+	}
+	return find_first<false>(loaded, 0, std::min(playback_chunk, chunk_count));
+}
+
+[[nodiscard]] static
+auto is_approximate(const detail::loader_state& state, size_t chunk_idx) -> bool {
+	return std::ranges::find(state.approximate_chunks, chunk_idx) != state.approximate_chunks.end();
+}
+
+// Chunks past the end of the seek index can only be jumped to
+// approximately. The chunks are replaced once the seek index reaches them.
+[[nodiscard]] static
+auto is_beyond_seek_index(const detail::loader_state& state, size_t chunk_idx) -> bool {
+	return !state.can_random_seek && !state.seek_index.empty() && chunk_idx >= state.seek_index.size();
+}
+
+// If the playhead is too far past the end of the seek index to decode our
+// way there in time, the chunks under it are jumped to approximately.
+[[nodiscard]] static
+auto get_next_chunk_to_jump_to(const detail::shared_safe& shared, const detail::loader_state& state) -> std::optional<size_t> {
+	const auto playback_chunk = get_playback_chunk(shared, state);
+	if (state.end_chunk || playback_chunk < state.seek_index.size() + APPROXIMATE_SEEK_DISTANCE) {
+		return std::nullopt;
+	}
+	const auto chunk_count = get_chunk_count(state.chunk_size, get_estimated_frame_count(shared.model.read(ez::nort)));
+	const auto end         = std::min(chunk_count, playback_chunk + APPROXIMATE_SEEK_LOOKAHEAD);
+	for (auto chunk_idx = playback_chunk; chunk_idx < end; chunk_idx++) {
+		if (!is_approximate(state, chunk_idx)) {
+			return chunk_idx;
+		}
+	}
+	return std::nullopt;
+}
+
+[[nodiscard]] static
+auto get_next_chunk_to_load(const detail::shared_safe& shared, const detail::loader_state& state) -> std::optional<size_t> {
+	if (state.can_random_seek) {
+		return get_next_chunk_to_load_random(shared, state);
+	}
+	if (!state.seek_index.empty()) {
+		if (const auto chunk_idx = get_next_chunk_to_jump_to(shared, state)) {
+			return chunk_idx;
+		}
+		return get_next_chunk_to_load_random(shared, state);
+	}
+	return state.next_chunk;
+}
+
+// Whether evicting a chunk would free anything. Silent chunks all share
+// the silent chunk, which has no bytes.
+[[nodiscard]] static
+auto holds_bytes(const detail::loader_state& state, size_t chunk_idx) -> bool {
+	return chunk_idx < state.chunks.size() && state.chunks[chunk_idx] && !state.chunks[chunk_idx]->bytes.empty();
+}
+
+// The approximate chunk holding bytes which is farthest from the playhead.
+[[nodiscard]] static
+auto find_approximate_chunk_to_evict(const detail::loader_state& state, size_t playback_chunk) -> std::optional<size_t> {
+	auto out = std::optional<size_t>{};
+	for (const auto chunk_idx : state.approximate_chunks) {
+		if (holds_bytes(state, chunk_idx)) {
+			out = get_farthest(playback_chunk, out, chunk_idx);
+		}
+	}
+	return out;
+}
+
+// The loaded chunk holding bytes which is farthest from the playhead.
+[[nodiscard]] static
+auto find_chunk_to_evict(const detail::shared_safe& shared, const detail::loader_state& state) -> std::optional<size_t> {
+	const auto playback_chunk = get_playback_chunk(shared, state);
+	auto ahead  = find_last<true>(shared.loaded, playback_chunk, detail::chunk_bitmap::CAPACITY);
+	auto behind = find_first<true>(shared.loaded, 0, playback_chunk);
+	while (ahead && !holds_bytes(state, *ahead)) {
+		ahead = find_last<true>(shared.loaded, playback_chunk, *ahead);
+	}
+	while (behind && !holds_bytes(state, *behind)) {
+		behind = find_first<true>(shared.loaded, *behind + 1, playback_chunk);
+	}
+	return get_farthest(playback_chunk, ahead, behind);
+}
+
+// The most a chunk can take up. Budget is reserved for this much before a
+// chunk is loaded, and whatever it didn't need is given back afterwards.
+[[nodiscard]] static
+auto get_chunk_bytes(const detail::loader_state& state) -> size_t {
+	return get_chunk_data_bytes(state.storage_format, state.interleaved->get_channel_count(), state.chunk_size);
+}
+
+[[nodiscard]] static
+auto try_reserve_chunk(ez::nort_t, detail::loader_state* state) -> bool {
+	const auto bytes = get_chunk_bytes(*state);
+	if (state->max_bytes > 0 && state->usage.bytes + bytes > state->max_bytes) {
+		return false;
+	}
+	if (const auto budget = state->usage.budget) {
+		auto used = budget->used.load(std::memory_order_relaxed);
+		do {
+			if (used + bytes > budget->max_bytes) {
+				return false;
+			}
+		} while (!budget->used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+	}
+	state->usage.bytes += bytes;
+	return true;
+}
+
+static
+auto force_reserve_chunk(ez::nort_t, detail::loader_state* state) -> void {
+	const auto bytes = get_chunk_bytes(*state);
+	if (const auto budget = state->usage.budget) {
+		budget->used.fetch_add(bytes, std::memory_order_relaxed);
+	}
+	state->usage.bytes += bytes;
+}
+
+static auto wake_budget_users(ez::nort_t, detail::memory_budget* budget) -> void;
+
+static
+auto release_bytes(ez::nort_t th, detail::loader_state* state, size_t bytes) -> void {
+	state->usage.bytes -= bytes;
+	if (const auto budget = state->usage.budget) {
+		budget->used.fetch_sub(bytes, std::memory_order_relaxed);
+		if (bytes > 0) {
+			wake_budget_users(th, budget);
+		}
+	}
+}
+
+// Call after taking the chunk out of the chunk directory. If the audio
+// thread is inside process() right now it might still be reading the chunk,
+// so hang on to it until it comes back out.
+static
+auto retire_chunk(ez::nort_t, detail::loader_state* state, const detail::shared_atomics& atomics, shptr<const chunk_data> data) -> void {
+	const auto audio_epoch = atomics.audio_epoch.load(std::memory_order_seq_cst);
+	state->retired.push_back({std::move(data), audio_epoch});
+}
+
+static
+auto evict_chunk(ez::nort_t th, detail::loader_state* state, detail::shared_safe* shared, size_t chunk_idx) -> void {
+	const auto bytes = state->chunks[chunk_idx]->bytes.size();
+	set_chunk(th, &shared->chunks, chunk_idx, nullptr);
+	clear_bit(th, &shared->loaded, chunk_idx);
+	retire_chunk(th, state, shared->atomics, std::move(state->chunks[chunk_idx]));
+	std::erase(state->approximate_chunks, chunk_idx);
+	if (is_memory_limited(*state)) {
+		release_bytes(th, state, bytes);
+	}
+}
+
+static
+auto free_retired_chunks(ez::nort_t, detail::loader_state* state, const detail::shared_atomics& atomics) -> void {
+	const auto audio_epoch = atomics.audio_epoch.load(std::memory_order_seq_cst);
+	std::erase_if(state->retired, [audio_epoch](const detail::retired_chunk& x) {
+		return x.audio_epoch % 2 == 0 || x.audio_epoch != audio_epoch;
+	});
+}
+
+// Evicts chunks which are farther from the playhead than the chunk we want
+// to load until there is enough room for it. The chunk under the playhead
+// is always loaded, even if that means going over budget. Formats which
+// can't random seek and have no seek index couldn't fetch an evicted chunk
+// again, so they only count towards the budget. Returns false if there isn't enough room.
+[[nodiscard]] static
+auto make_room(ez::nort_t th, detail::loader_state* state, detail::shared_safe* shared, size_t chunk_idx) -> bool {
+	if (!is_memory_limited(*state)) {
+		return true;
+	}
+	if (!can_reload(*state)) {
+		force_reserve_chunk(th, state);
+		return true;
+	}
+	const auto playback_chunk = get_playback_chunk(*shared, *state);
+	const auto distance       = get_distance_from_playhead(playback_chunk, chunk_idx);
+	while (!try_reserve_chunk(th, state)) {
+		const auto victim = get_farthest(playback_chunk, find_chunk_to_evict(*shared, *state), find_approximate_chunk_to_evict(*state, playback_chunk));
+		if (!victim || get_distance_from_playhead(playback_chunk, *victim) <= distance) {
+			if (chunk_idx == playback_chunk) {
+				force_reserve_chunk(th, state);
+				return true;
+			}
+			return false;
+		}
+		evict_chunk(th, state, shared, *victim);
+	}
+	return true;
+}
+
+[[nodiscard]] static
+auto calculate_frame_count_from_end_chunk(size_t chunk_size, size_t end_chunk, ads::frame_count frames_in_end_chunk) -> ads::frame_count {
+	return frames_in_end_chunk + ads::frame_count{end_chunk * chunk_size};
+}
+
+// An MP3's frame count only came from scanning its headers, so what the
+// decoder actually produced wins.
+[[nodiscard]] static
+auto get_frame_count_at_end(const audiorw::header& header, ads::frame_count frames_decoded) -> ads::frame_count {
+	if (header.format == audiorw::format::mp3) {
+		return frames_decoded;
+	}
+	return header.frame_count.value_or(frames_decoded);
+}
+
+[[nodiscard]] static
+auto estimate_frame_count(ads::frame_count total_frames_read, size_t total_bytes_read, size_t file_size) -> ads::frame_count {
+	if (total_bytes_read == 0 || file_size == 0) {
+		return total_frames_read;
+	}
+	const auto byte_progress = static_cast<double>(total_bytes_read) / static_cast<double>(file_size);
+	const auto estimate      = static_cast<double>(total_frames_read.value) / byte_progress;
+	return {static_cast<uint64_t>(estimate)};
+}
+
+[[nodiscard]] static
+auto find_cached_chunk(ez::nort_t, detail::chunk_cache* cache, const std::string& identity, size_t chunk_size, size_t chunk_idx, afs::sample_format format) -> std::optional<detail::decoded_chunk> {
+	if (!cache || identity.empty()) {
+		return std::nullopt;
+	}
+	auto lock = std::unique_lock{cache->mutex};
+	const auto pos = cache->entries.find(detail::cache_key{identity, chunk_size, chunk_idx, format});
+	if (pos == cache->entries.end()) {
+		return std::nullopt;
+	}
+	auto& entry = pos->second;
+	cache->lru.splice(cache->lru.begin(), cache->lru, entry.lru_pos);
+	return detail::decoded_chunk{entry.data, entry.frame_count};
+}
+
+static
+auto trim_cache(ez::nort_t, detail::chunk_cache* cache) -> void {
+	while (cache->bytes > cache->max_bytes && !cache->lru.empty()) {
+		const auto pos = cache->entries.find(cache->lru.back());
+		cache->bytes -= pos->second.bytes;
+		cache->entries.erase(pos);
+		cache->lru.pop_back();
+	}
+}
+
+static
+auto cache_chunk(ez::nort_t th, detail::chunk_cache* cache, const std::string& identity, size_t chunk_size, size_t chunk_idx, afs::sample_format format, const detail::decoded_chunk& chunk) -> void {
+	if (!cache || identity.empty()) {
+		return;
+	}
+	auto lock = std::unique_lock{cache->mutex};
+	auto key  = detail::cache_key{identity, chunk_size, chunk_idx, format};
+	const auto bytes = chunk.data->bytes.size();
+	if (cache->entries.contains(key)) {
+		// Another streamer got here first.
+		return;
+	}
+	cache->lru.push_front(key);
+	cache->entries[std::move(key)] = {chunk.data, chunk.frame_count, bytes, cache->lru.begin()};
+	cache->bytes += bytes;
+	trim_cache(th, cache);
+}
+
+inline
+mapped_file::~mapped_file() {
+#if defined(_WIN32)
+	if (data)                         { UnmapViewOfFile(data); }
+	if (mapping)                      { CloseHandle(mapping); }
+	if (file != INVALID_HANDLE_VALUE) { CloseHandle(file); }
+#else
+	if (data)    { munmap(const_cast<std::byte*>(data), size); }
+	if (fd >= 0) { close(fd); }
+#endif
+}
+
+// Returns null if the file doesn't exist, is empty or can't be mapped.
+[[nodiscard]] static
+auto map_file(ez::nort_t, const std::filesystem::path& path) -> uptr<detail::mapped_file> {
+	auto out = make_uptr<detail::mapped_file>();
+#if defined(_WIN32)
+	out->file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (out->file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	auto size = LARGE_INTEGER{};
+	if (!GetFileSizeEx(out->file, &size) || size.QuadPart <= 0) {
+		return nullptr;
+	}
+	out->mapping = CreateFileMappingW(out->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!out->mapping) {
+		return nullptr;
+	}
+	out->data = static_cast<const std::byte*>(MapViewOfFile(out->mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!out->data) {
+		return nullptr;
+	}
+	out->size = static_cast<size_t>(size.QuadPart);
+#else
+	out->fd = open(path.c_str(), O_RDONLY);
+	if (out->fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(out->fd, &st) != 0 || st.st_size <= 0) {
+		return nullptr;
+	}
+	const auto data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, out->fd, 0);
+	if (data == MAP_FAILED) {
+		return nullptr;
+	}
+	out->data = static_cast<const std::byte*>(data);
+	out->size = static_cast<size_t>(st.st_size);
+#endif
+	return out;
+}
+
+[[nodiscard]] static
+auto read_u16(const std::byte* p) -> uint16_t {
+	auto out = uint16_t{};
+	std::memcpy(&out, p, sizeof(out));
+	return out;
+}
+
+[[nodiscard]] static
+auto read_u32(const std::byte* p) -> uint32_t {
+	auto out = uint32_t{};
+	std::memcpy(&out, p, sizeof(out));
+	return out;
+}
+
+[[nodiscard]] static
+auto get_wav_sample_format(uint16_t format_tag, uint16_t bits_per_sample) -> std::optional<afs::sample_format> {
+	static constexpr auto WAVE_FORMAT_PCM        = uint16_t{0x0001};
+	static constexpr auto WAVE_FORMAT_IEEE_FLOAT = uint16_t{0x0003};
+	if (format_tag == WAVE_FORMAT_PCM) {
+		switch (bits_per_sample) {
+			case 8:  { return afs::sample_format::uint8; }
+			case 16: { return afs::sample_format::int16; }
+			case 24: { return afs::sample_format::int24; }
+			case 32: { return afs::sample_format::int32; }
+			default: { return std::nullopt; }
+		}
+	}
+	if (format_tag == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 32) {
+		return afs::sample_format::float32;
+	}
+	return std::nullopt;
+}
+
+// Returns null if the file isn't a WAV file which can be played straight
+// from the mapping, or doesn't match the header of the stream.
+[[nodiscard]] static
+auto map_wav(ez::nort_t th, const std::filesystem::path& path, const audiorw::header& header) -> uptr<detail::mapped_wav> {
+	static constexpr auto WAVE_FORMAT_EXTENSIBLE = uint16_t{0xFFFE};
+	auto file = map_file(th, path);
+	if (!file || file->size < 12) {
+		return nullptr;
+	}
+	const auto data = file->data;
+	if (std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "WAVE", 4) != 0) {
+		return nullptr;
+	}
+	auto out = make_uptr<detail::mapped_wav>();
+	auto have_fmt = false;
+	auto pos = size_t{12};
+	while (file->size - pos >= 8) {
+		const auto id   = data + pos;
+		const auto size = size_t{read_u32(data + pos + 4)};
+		const auto body = pos + 8;
+		if (std::memcmp(id, "fmt ", 4) == 0) {
+			if (size < 16 || file->size - body < 16) {
+				return nullptr;
+			}
+			auto format_tag            = read_u16(data + body);
+			const auto channel_count   = read_u16(data + body + 2);
+			const auto SR              = read_u32(data + body + 4);
+			const auto block_align     = read_u16(data + body + 12);
+			const auto bits_per_sample = read_u16(data + body + 14);
+			if (format_tag == WAVE_FORMAT_EXTENSIBLE && size >= 26 && file->size - body >= 26) {
+				// The format tag is at the start of the sub-format GUID.
+				format_tag = read_u16(data + body + 24);
+			}
+			const auto format = get_wav_sample_format(format_tag, bits_per_sample);
+			if (!format || channel_count != header.channel_count.value || SR != static_cast<uint32_t>(header.SR)) {
+				return nullptr;
+			}
+			out->format           = *format;
+			out->bytes_per_sample = bits_per_sample / 8;
+			out->block_align      = block_align;
+			if (out->block_align != out->bytes_per_sample * channel_count) {
+				return nullptr;
+			}
+			have_fmt = true;
+		}
+		else if (std::memcmp(id, "data", 4) == 0) {
+			if (!have_fmt) {
+				return nullptr;
+			}
+			// Trust the file size over the chunk size if the file was truncated.
+			const auto data_size = std::min(size, file->size - body);
+			out->frames      = data + body;
+			out->frame_count = data_size / out->block_align;
+			if (header.frame_count && header.frame_count->value != out->frame_count) {
+				return nullptr;
+			}
+			out->file = std::move(file);
+			return out;
+		}
+		if (file->size - body < size) {
+			return nullptr;
+		}
+		pos = body + size + (size & 1);
+	}
+	return nullptr;
+}
+
+[[nodiscard]] static
+auto read_u32_be(const std::byte* p) -> uint32_t {
+	return (std::to_integer<uint32_t>(p[0]) << 24) | (std::to_integer<uint32_t>(p[1]) << 16) | (std::to_integer<uint32_t>(p[2]) << 8) | std::to_integer<uint32_t>(p[3]);
+}
+
+[[nodiscard]] static
+auto read_mp3_frame_header(const std::byte* p) -> std::optional<detail::mp3_frame_header> {
+	static constexpr uint16_t BITRATES[2][3][15] = {
+		// MPEG 1, layers I, II and III.
+		{{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+		 {0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384},
+		 {0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320}},
+		// MPEG 2 and 2.5.
+		{{0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256},
+		 {0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160},
+		 {0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160}},
+	};
+	static constexpr uint32_t SRS[3] = {44100, 48000, 32000};
+	const auto bits        = read_u32_be(p);
+	const auto version     = (bits >> 19) & 3;
+	const auto layer       = 4 - ((bits >> 17) & 3);
+	const auto bitrate_idx = (bits >> 12) & 15;
+	const auto SR_idx      = (bits >> 10) & 3;
+	const auto padding     = (bits >> 9) & 1;
+	const auto mono        = ((bits >> 6) & 3) == 3;
+	// Free format frames (bitrate index 0) don't say how long they are.
+	if ((bits & 0xFFE00000) != 0xFFE00000 || version == 1 || layer == 4 || bitrate_idx == 0 || bitrate_idx == 15 || SR_idx == 3) {
+		return std::nullopt;
+	}
+	const auto mpeg1   = version == 3;
+	const auto bitrate = BITRATES[mpeg1 ? 0 : 1][layer - 1][bitrate_idx] * 1000;
+	auto out = detail::mp3_frame_header{};
+	out.version = version;
+	out.layer   = layer;
+	out.SR      = SRS[SR_idx] >> (mpeg1 ? 0 : version == 2 ? 1 : 2);
+	out.frames  = layer == 1 ? 384 : layer == 3 && !mpeg1 ? 576 : 1152;
+	out.bytes   = layer == 1 ? (12 * bitrate / out.SR + padding) * 4 : out.frames / 8 * bitrate / out.SR + padding;
+	if (layer == 3) {
+		out.side_info_bytes = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+	}
+	return out;
+}
+
+// Checks the frame after this one too, so that random bytes which happen to
+// look like a header aren't mistaken for one.
+[[nodiscard]] static
+auto is_mp3_frame(const std::byte* data, size_t pos, size_t end, const detail::mp3_frame_header& like) -> bool {
+	const auto is_like = [&](size_t pos) {
+		if (end - pos < 4) { return false; }
+		const auto header = read_mp3_frame_header(data + pos);
+		return header && header->version == like.version && header->layer == like.layer && header->SR == like.SR && end - pos >= header->bytes;
+	};
+	if (!is_like(pos)) {
+		return false;
+	}
+	const auto next = pos + read_mp3_frame_header(data + pos)->bytes;
+	return next == end || is_like(next);
+}
+
+[[nodiscard]] static
+auto find_first_mp3_frame(const std::byte* data, size_t pos, size_t end) -> std::optional<size_t> {
+	for (; end - pos >= 4; pos++) {
+		if (const auto header = read_mp3_frame_header(data + pos)) {
+			if (is_mp3_frame(data, pos, end, *header)) {
+				return pos;
+			}
+		}
+	}
+	return std::nullopt;
+}
+
+// Skips any ID3v2 tags at the start of the file.
+[[nodiscard]] static
+auto skip_id3v2(const std::byte* data, size_t end) -> size_t {
+	auto pos = size_t{0};
+	while (end - pos >= 10 && std::memcmp(data + pos, "ID3", 3) == 0) {
+		const auto has_footer = (std::to_integer<uint32_t>(data[pos + 5]) & 0x10) != 0;
+		auto size = size_t{10};
+		for (size_t i = 6; i < 10; i++) {
+			size += size_t{std::to_integer<uint8_t>(data[pos + i]) & 0x7Fu} << (7 * (9 - i));
+		}
+		size += has_footer ? 10 : 0;
+		if (end - pos < size) {
+			return end;
+		}
+		pos += size;
+	}
+	return pos;
+}
+
+[[nodiscard]] static
+auto read_mp3_info(const std::byte* frame, const detail::mp3_frame_header& header) -> detail::mp3_info {
+	auto out = detail::mp3_info{};
+	const auto xing = 4 + header.side_info_bytes;
+	if (header.layer == 3 && header.bytes >= xing + 8 && (std::memcmp(frame + xing, "Xing", 4) == 0 || std::memcmp(frame + xing, "Info", 4) == 0)) {
+		out.is_info_frame = true;
+		const auto flags = read_u32_be(frame + xing + 4);
+		auto pos = xing + 8;
+		auto mp3_frames = std::optional<uint64_t>{};
+		if ((flags & 1) && header.bytes >= pos + 4) { mp3_frames = read_u32_be(frame + pos); pos += 4; }
+		if (flags & 2)                              { pos += 4; }
+		if (flags & 4)                              { pos += 100; }
+		if (flags & 8)                              { pos += 4; }
+		if (!mp3_frames) {
+			return out;
+		}
+		auto frames = *mp3_frames * header.frames;
+		// The LAME tag says how many frames of encoder delay and padding the
+		// decoder will trim from the start and end.
+		if (header.bytes >= pos + 24 && (std::memcmp(frame + pos, "LAME", 4) == 0 || std::memcmp(frame + pos, "Lav", 3) == 0)) {
+			const auto b21     = std::to_integer<uint32_t>(frame[pos + 21]);
+			const auto b22     = std::to_integer<uint32_t>(frame[pos + 22]);
+			const auto b23     = std::to_integer<uint32_t>(frame[pos + 23]);
+			const auto trimmed = uint64_t{(b21 << 4) | (b22 >> 4)} + uint64_t{((b22 & 0xF) << 8) | b23};
+			frames -= std::min(frames, trimmed);
+		}
+		out.frame_count = ads::frame_count{frames};
+		return out;
+	}
+	static constexpr auto VBRI = size_t{4 + 32};
+	if (header.layer == 3 && header.bytes >= VBRI + 18 && std::memcmp(frame + VBRI, "VBRI", 4) == 0) {
+		out.is_info_frame = true;
+		out.frame_count   = ads::frame_count{uint64_t{read_u32_be(frame + VBRI + 14)} * header.frames};
+	}
+	return out;
+}
+
+// Works out how many frames an MP3 file will decode to without decoding
+// it. If the first frame has a Xing/Info or VBRI header this only reads
+// that, otherwise it walks the frame headers. Returns nullopt if it isn't
+// an MP3 file or should_stop() returns true first.
+[[nodiscard]] static
+auto scan_mp3_frame_count(ez::nort_t, const detail::mapped_file& file, auto should_stop) -> std::optional<ads::frame_count> {
+	static constexpr auto STOP_CHECK_INTERVAL = size_t{4096};
+	const auto data = file.data;
+	auto end = file.size;
+	if (end >= 128 && std::memcmp(data + end - 128, "TAG", 3) == 0) {
+		// ID3v1 tag.
+		end -= 128;
+	}
+	const auto first_pos = find_first_mp3_frame(data, skip_id3v2(data, end), end);
+	if (!first_pos) {
+		return std::nullopt;
+	}
+	const auto first = *read_mp3_frame_header(data + *first_pos);
+	const auto info  = read_mp3_info(data + *first_pos, first);
+	if (info.frame_count) {
+		return info.frame_count;
+	}
+	auto pos    = *first_pos + (info.is_info_frame ? first.bytes : 0);
+	auto frames = uint64_t{0};
+	for (size_t steps = 1; end - pos >= 4; steps++) {
+		if (steps % STOP_CHECK_INTERVAL == 0 && should_stop()) {
+			return std::nullopt;
+		}
+		const auto header = read_mp3_frame_header(data + pos);
+		if (header && header->version == first.version && header->layer == first.layer && header->SR == first.SR && end - pos >= header->bytes) {
+			frames += header->frames;
+			pos    += header->bytes;
+			continue;
+		}
+		// Lost sync, e.g. because of junk between frames.
+		pos++;
+		while (end - pos >= 4 && !is_mp3_frame(data, pos, end, first)) {
+			if (++steps % STOP_CHECK_INTERVAL == 0 && should_stop()) {
+				return std::nullopt;
+			}
+			pos++;
+		}
+	}
+	return ads::frame_count{frames};
+}
+
+template <typename StopToken> static
+auto scan_proc(StopToken stop, detail::shared_safe* shared, std::filesystem::path path) -> void {
+	const auto file = map_file(ez::nort, path);
+	if (!file) {
+		return;
+	}
+	const auto frame_count = scan_mp3_frame_count(ez::nort, *file, [&stop] { return stop.stop_requested(); });
+	if (!frame_count) {
+		return;
+	}
+	publish(ez::nort, shared, [=](detail::model x) {
+		if (!x.header.frame_count) {
+			x.header.frame_count = *frame_count;
+		}
+		return x;
+	});
+}
+
+// FNV-1a. The cache file names have to be the same from run to run, which
+// std::hash doesn't promise.
+[[nodiscard]] static
+auto hash_identity(const std::string& identity) -> uint64_t {
+	auto out = uint64_t{14695981039346656037u};
+	for (const auto c : identity) {
+		out ^= static_cast<uint8_t>(c);
+		out *= 1099511628211u;
+	}
+	return out;
+}
+
+[[nodiscard]] static
+auto make_disk_cache_path(const detail::disk_cache& cache, const std::string& identity, size_t chunk_size, afs::sample_format format) -> std::filesystem::path {
+	char hash[17];
+	std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(hash_identity(identity)));
+	return cache.dir / (std::string{hash} + '-' + std::to_string(chunk_size) + '-' + std::to_string(static_cast<int>(format)) + ".afspcm");
+}
+
+// Reads the records out of an existing cache file. Returns false if the
+// file is for something else, or is damaged, e.g. because a write was
+// interrupted.
+[[nodiscard]] static
+auto read_disk_cache_records(ez::nort_t, detail::disk_cache_file* file, const std::string& identity, size_t chunk_size) -> bool {
+	const auto& mapping      = *file->mapping;
+	const auto channel_count = ads::channel_count{file->channel_count};
+	auto header = detail::disk_cache_header{};
+	if (mapping.size < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, mapping.data, sizeof(header));
+	if (header.magic != DISK_CACHE_MAGIC || header.chunk_size != chunk_size || header.channel_count != file->channel_count || header.format != static_cast<uint32_t>(file->format) || header.identity_size != identity.size()) {
+		return false;
+	}
+	auto pos = sizeof(header);
+	if (mapping.size - pos < identity.size() || std::memcmp(mapping.data + pos, identity.data(), identity.size()) != 0) {
+		return false;
+	}
+	pos += identity.size();
+	while (pos < mapping.size) {
+		auto record = detail::disk_cache_record_header{};
+		if (mapping.size - pos < sizeof(record)) {
+			return false;
+		}
+		std::memcpy(&record, mapping.data + pos, sizeof(record));
+		pos += sizeof(record);
+		if (record.frame_count > chunk_size || mapping.size - pos < record.byte_count) {
+			return false;
+		}
+		if (record.byte_count != 0 && record.byte_count != get_chunk_data_bytes(file->format, channel_count, record.frame_count)) {
+			return false;
+		}
+		file->records[record.chunk_idx] = {pos, ads::frame_count{record.frame_count}, record.byte_count};
+		file->written.insert(record.chunk_idx);
+		pos += record.byte_count;
+	}
+	return true;
+}
+
+// Returns null if the cache file can't be written.
+[[nodiscard]] static
+auto open_disk_cache_file(ez::nort_t th, detail::disk_cache* cache, const std::string& identity, size_t chunk_size, ads::channel_count channel_count, afs::sample_format format) -> shptr<detail::disk_cache_file> {
+	auto lock = std::unique_lock{cache->mutex};
+	const auto path = make_disk_cache_path(*cache, identity, chunk_size, format);
+	const auto key  = path.string();
+	if (auto file = cache->files[key].lock()) {
+		return file;
+	}
+	auto file = make_shptr<detail::disk_cache_file>();
+	file->channel_count = channel_count.value;
+	file->format        = format;
+	file->mapping       = map_file(th, path);
+	if (file->mapping && read_disk_cache_records(th, file.get(), identity, chunk_size)) {
+		file->out.open(path, std::ios::binary | std::ios::app);
+	}
+	else {
+		file->mapping.reset();
+		file->records.clear();
+		file->written.clear();
+		auto ec = std::error_code{};
+		std::filesystem::create_directories(cache->dir, ec);
+		file->out.open(path, std::ios::binary | std::ios::trunc);
+		auto header = detail::disk_cache_header{};
+		header.magic         = DISK_CACHE_MAGIC;
+		header.chunk_size    = static_cast<uint32_t>(chunk_size);
+		header.channel_count = static_cast<uint32_t>(channel_count.value);
+		header.format        = static_cast<uint32_t>(format);
+		header.identity_size = identity.size();
+		file->out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file->out.write(identity.data(), static_cast<std::streamsize>(identity.size()));
+		file->out.flush();
+	}
+	if (!file->out && file->records.empty()) {
+		return nullptr;
+	}
+	cache->files[key] = file;
+	return file;
+}
+
+[[nodiscard]] static
+auto read_disk_cached_chunk(ez::nort_t th, detail::chunk_pool* pool, detail::disk_cache_file* file, size_t chunk_idx) -> std::optional<detail::decoded_chunk> {
+	if (!file) {
+		return std::nullopt;
+	}
+	auto lock = std::unique_lock{file->mutex};
+	const auto pos = file->records.find(chunk_idx);
+	if (pos == file->records.end()) {
+		return std::nullopt;
+	}
+	const auto& record = pos->second;
+	if (record.byte_count == 0) {
+		return detail::decoded_chunk{get_silent_chunk(), record.frame_count};
+	}
+	auto chunk_data = make_chunk_data(th, pool, file->format, ads::channel_count{file->channel_count}, record.frame_count.value);
+	std::memcpy(chunk_data->bytes.data(), file->mapping->data + record.offset, record.byte_count);
+	return detail::decoded_chunk{chunk_data, record.frame_count};
+}
+
+static
+auto write_disk_cached_chunk(ez::nort_t, detail::disk_cache_file* file, size_t chunk_idx, const detail::decoded_chunk& chunk) -> void {
+	if (!file) {
+		return;
+	}
+	auto lock = std::unique_lock{file->mutex};
+	if (!file->out || file->written.contains(chunk_idx)) {
+		return;
+	}
+	const auto record = detail::disk_cache_record_header{chunk_idx, chunk.frame_count.value, chunk.data->bytes.size()};
+	file->out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+	file->out.write(reinterpret_cast<const char*>(chunk.data->bytes.data()), static_cast<std::streamsize>(chunk.data->bytes.size()));
+	file->out.flush();
+	file->written.insert(chunk_idx);
+}
+
+// Guesses where a chunk past the end of the seek index starts, by assuming
+// the bitrate from the last indexed point to the end of the file is
+// constant. The stream resynchronises on the next frame header after the
+// byte offset, so the chunk will only be roughly in the right place.
+[[nodiscard]] static
+auto estimate_seek_point(const detail::loader_state& state, const detail::model& model, size_t chunk_idx) -> afs::stream_seek_point {
+	const auto& last       = state.seek_index.back();
+	const auto frame_count = static_cast<double>(get_estimated_frame_count(model).value);
+	const auto frame       = std::max(get_chunk_beg(state.chunk_size, chunk_idx).value - APPROXIMATE_SEEK_PRIMING, last.frame.value);
+	const auto frames_left = std::max(frame_count - static_cast<double>(last.frame.value), 1.0);
+	const auto bytes_left  = static_cast<double>(model.header.stream_length > last.byte_offset ? model.header.stream_length - last.byte_offset : 0);
+	const auto offset      = static_cast<double>(frame - last.frame.value) * (bytes_left / frames_left);
+	return {last.byte_offset + static_cast<size_t>(offset), ads::frame_idx{frame}};
+}
+
+// Checks the model for a new seek target. The loader loads around it
+// straight away instead of waiting for the audio thread to get there and
+// report its playback position. Returns true if the chunk the target is in
+// isn't loaded and isn't chunk_idx, i.e. whatever is being loaded for
+// chunk_idx can wait.
+[[nodiscard]] static
+auto has_seek_target_moved(ez::nort_t th, detail::loader_state* state, detail::shared_safe* shared, uint64_t* model_version, std::optional<size_t> chunk_idx) -> bool {
+	const auto version = shared->atomics.model_version.load(std::memory_order_acquire);
+	if (version == *model_version) {
+		return false;
+	}
+	*model_version = version;
+	const auto target = shared->model.read(th).target.seek_pos;
+	if (target == state->seek_pos) {
+		return false;
+	}
+	state->seek_pos = target;
+	const auto target_chunk = get_chunk_idx(state->chunk_size, target);
+	return target_chunk != chunk_idx && !is_bit_set(shared->loaded, target_chunk);
+}
+
+// Jumps to a seek point, then decodes and throws away the frames between it
+// and the start of the chunk.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto seek_to_chunk(ez::nort_t, detail::loader<Stream, JThread>* loader, detail::shared_atomics* atomics, afs::stream_seek_point point, size_t chunk_idx) -> void {
+	if constexpr (afs::concepts::seek_point_stream<Stream>) {
+		auto& state = loader->state;
+		const auto channel_count = state.interleaved->get_channel_count();
+		loader->stream->seek_to(point);
+		atomics->stream_seeks.fetch_add(1, std::memory_order_relaxed);
+		auto priming = get_chunk_beg(state.chunk_size, chunk_idx).value - point.frame.value;
+		while (priming > 0) {
+			const auto frames      = std::min(static_cast<size_t>(priming), state.interleaved->get_frame_count().value);
+			const auto frames_read = loader->stream->read_frames(std::span{state.interleaved->data(), frames * channel_count.value});
+			if (frames_read.value == 0) {
+				break;
+			}
+			priming -= static_cast<int64_t>(frames_read.value);
+		}
+		state.stream_pos = get_chunk_beg(state.chunk_size, chunk_idx);
+	}
+}
+
+// Seeking can make the decoder throw away its state and read-ahead, so it
+// is skipped if the stream is already there.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto seek_stream(ez::nort_t, detail::loader<Stream, JThread>* loader, detail::shared_atomics* atomics, ads::frame_idx pos) -> void {
+	auto& state = loader->state;
+	if (state.stream_pos == pos) {
+		return;
+	}
+	loader->stream->seek(pos);
+	atomics->stream_seeks.fetch_add(1, std::memory_order_relaxed);
+	state.stream_pos = pos;
+}
+
+[[nodiscard]] static
+auto is_playhead_waiting_for(const detail::shared_safe& shared, const detail::loader_state& state, size_t chunk_idx) -> bool {
+	const auto replacing = chunk_idx < state.chunks.size() && state.chunks[chunk_idx];
+	return !replacing && chunk_idx == get_playback_chunk(shared, state);
+}
+
+[[nodiscard]] static
+auto get_decode_slice_size(ads::channel_count channel_count) -> size_t {
+	const auto frames = DECODE_SLICE_BYTES / (std::max(channel_count.value, size_t{1}) * sizeof(float));
+	return std::clamp(std::bit_floor(frames), size_t{64}, DECODE_SLICE_SIZE);
+}
+
+// Where to start decoding a chunk the playhead is waiting for. If it is
+// waiting well into the chunk, decoding starts right there and the frames
+// before it are filled in afterwards, so the wait doesn't depend on where
+// in the chunk a seek landed.
+[[nodiscard]] static
+auto get_first_frame_to_decode(const detail::shared_safe& shared, const detail::loader_state& state, size_t chunk_idx) -> size_t {
+	if (!state.can_random_seek) {
+		return 0;
+	}
+	const auto pos = get_playhead_pos(shared, state);
+	if (pos < 0.0 || get_chunk_idx(state.chunk_size, pos) != chunk_idx) {
+		return 0;
+	}
+	const auto local_fr = static_cast<size_t>(get_local_chunk_frame(state.chunk_size, ads::frame_idx{static_cast<int64_t>(pos)}).value);
+	return local_fr < DECODE_SLICE_SIZE ? 0 : local_fr;
+}
+
+// How many frames to allocate for a chunk. If the frame count is known the
+// last chunk is allocated at exactly the size it needs. An MP3's frame
+// count might only be an estimate, so its last chunk is allocated at full
+// size and copied into a smaller one once it has been decoded.
+[[nodiscard]] static
+auto get_chunk_capacity(const detail::model& model, const detail::loader_state& state, size_t chunk_idx) -> size_t {
+	const auto chunk_beg = static_cast<size_t>(get_chunk_beg(state.chunk_size, chunk_idx).value);
+	if (!state.can_random_seek || !model.header.frame_count) {
+		return state.chunk_size;
+	}
+	const auto frame_count = static_cast<size_t>(model.header.frame_count->value);
+	if (frame_count <= chunk_beg) {
+		return state.chunk_size;
+	}
+	return std::min(state.chunk_size, frame_count - chunk_beg);
+}
+
+// Decodes frames [beg, end) of a chunk a slice at a time. Each slice is
+// decoded into the interleaved buffer and copied into the chunk while it is
+// still in cache, then publish_slice is called with the frame decoding has
+// got up to. silent is cleared if any of the frames aren't silent. Returns
+// the frame the stream ran out at (or end), or nullopt if a seek made the
+// loader give up on the chunk.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto decode_slices(ez::nort_t th, detail::loader<Stream, JThread>* loader, detail::shared_safe* shared, uint64_t* model_version, size_t chunk_idx, detail::chunk_data* chunk, size_t beg, size_t end, auto publish_slice, bool* silent) -> std::optional<size_t> {
+	auto& state = loader->state;
+	const auto channel_count    = state.interleaved->get_channel_count();
+	const auto slice_size       = state.interleaved->get_frame_count().value;
+	const auto bytes_per_sample = get_bytes_per_sample(state.storage_format);
+	const auto chunk_beg        = get_chunk_beg(state.chunk_size, chunk_idx);
+	auto pos = beg;
+	while (pos < end) {
+		// Formats which can't get back to this chunk have to finish it.
+		if (pos > beg && can_reload(state) && has_seek_target_moved(th, &state, shared, model_version, chunk_idx)) {
+			return std::nullopt;
+		}
+		const auto frames     = std::min(slice_size, end - pos);
+		const auto slice_read = loader->stream->read_frames(std::span{state.interleaved->data(), frames * channel_count.value}).value;
+		const auto samples    = std::span{state.interleaved->data(), slice_read * channel_count.value};
+		*silent = *silent && is_silent(samples);
+		deinterleave_samples(get_isa(), state.storage_format, samples.data(), channel_count, slice_read, chunk->bytes.data() + pos * bytes_per_sample, chunk->frame_count * bytes_per_sample);
+		publish_slice(pos + slice_read);
+		pos += slice_read;
+		state.stream_pos = ads::frame_idx{chunk_beg.value + static_cast<int64_t>(pos)};
+		if (slice_read < frames) {
+			break;
+		}
+	}
+	return pos;
+}
+
+// Publishes a new estimate of the frame count if it isn't known.
+// frames_read is how many frames the stream has read since the start.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto publish_estimate(ez::nort_t th, detail::loader<Stream, JThread>* loader, detail::shared_safe* shared, ads::frame_count frames_read) -> void {
+	if (shared->model.read(th).header.frame_count) {
+		return;
+	}
+	publish(th, shared, [=](detail::model x) {
+		if (!x.header.frame_count) { x.estimated_frame_count = estimate_frame_count(frames_read, loader->stream->get_total_bytes_read(), x.header.stream_length); }
+		return x;
+	});
+}
+
+// Returns nullopt if a seek made the loader give up on the chunk.
+// update_estimate is true if the chunk is read straight on from the start
+// of the stream.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto decode_chunk(ez::nort_t th, detail::loader<Stream, JThread>* loader, detail::shared_safe* shared, uint64_t model_version, const detail::model& model, size_t chunk_idx, bool approximate, bool update_estimate) -> std::optional<detail::decoded_chunk> {
+	auto& state = loader->state;
+	const auto channel_count = state.interleaved->get_channel_count();
+	const auto indexed       = !state.seek_index.empty();
+	const auto sequential    = state.stream_pos == get_chunk_beg(state.chunk_size, chunk_idx) && state.stream_approximate == approximate;
+	// If the playhead is waiting for this chunk it is published after the
+	// first slice and filled in a slice at a time, so that playback can
+	// start before the whole chunk is decoded.
+	const auto waiting  = is_playhead_waiting_for(*shared, state, chunk_idx);
+	const auto capacity = get_chunk_capacity(model, state, chunk_idx);
+	const auto playhead = waiting ? get_first_frame_to_decode(*shared, state, chunk_idx) : size_t{0};
+	const auto first    = playhead < capacity ? playhead : size_t{0};
+	auto chunk = make_chunk_data(th, state.chunk_pool.get(), state.storage_format, channel_count, capacity);
+	auto published = false;
+	const auto publish_slice = [&](size_t ready_frames) {
+		if (!waiting) {
+			return;
+		}
+		chunk->ready_frames.store(ready_frames, std::memory_order_release);
+		if (!published) {
+			// If the stream's length isn't known, give the model an estimate
+			// before the audio thread can see any frames.
+			if (update_estimate && first == 0) {
+				publish_estimate(th, loader, shared, state.total_frames_read + ads::frame_count{ready_frames});
+			}
+			set_chunk(th, &shared->chunks, chunk_idx, chunk.get());
+			published = true;
+		}
+	};
+	if (waiting) {
+		chunk->ready_beg.store(first, std::memory_order_relaxed);
+		chunk->ready_frames.store(first, std::memory_order_relaxed);
+	}
+	if (!indexed)         { seek_stream(th, loader, &shared->atomics, ads::frame_idx{get_chunk_beg(state.chunk_size, chunk_idx).value + static_cast<int64_t>(first)}); }
+	else if (approximate) { if (!sequential) { seek_to_chunk(th, loader, &shared->atomics, estimate_seek_point(state, model, chunk_idx), chunk_idx); } }
+	else                  { if (!sequential) { seek_to_chunk(th, loader, &shared->atomics, state.seek_index[chunk_idx], chunk_idx); } }
+	auto silent = true;
+	auto end    = decode_slices(th, loader, shared, &model_version, chunk_idx, chunk.get(), first, capacity, publish_slice, &silent);
+	if (end && first > 0) {
+		// Go back for the frames before the playhead.
+		seek_stream(th, loader, &shared->atomics, get_chunk_beg(state.chunk_size, chunk_idx));
+		const auto front_end = decode_slices(th, loader, shared, &model_version, chunk_idx, chunk.get(), 0, first, [](size_t) {}, &silent);
+		if (!front_end) {
+			end = std::nullopt;
+		}
+		else {
+			if (*end == first) {
+				// The stream ended before the playhead.
+				end = front_end;
+			}
+			else if (*front_end < first) {
+				// The stream gave out on the way back, although it didn't
+				// before. The chunk's buffer might be a recycled one, so
+				// the frames it didn't get to could hold anything.
+				clear_frames(th, chunk.get(), channel_count, *front_end, first);
+			}
+			chunk->ready_beg.store(0, std::memory_order_release);
+		}
+	}
+	if (!end) {
+		if (published) {
+			set_chunk(th, &shared->chunks, chunk_idx, nullptr);
+			retire_chunk(th, &state, shared->atomics, std::move(chunk));
+		}
+		return std::nullopt;
+	}
+	const auto frames_read = ads::frame_count{*end};
+	shared->atomics.chunks_decoded.fetch_add(1, std::memory_order_relaxed);
+	if (indexed) {
+		state.stream_approximate = approximate;
+		if constexpr (afs::concepts::seek_point_stream<Stream>) {
+			if (!approximate && frames_read == ads::frame_count{state.chunk_size} && chunk_idx + 1 == state.seek_index.size()) {
+				state.seek_index.push_back(loader->stream->get_seek_point());
+			}
+		}
+	}
+	// Estimates of the frame count assume the stream has been read from the
+	// start.
+	if (!indexed || (sequential && !approximate)) {
+		state.total_frames_read += frames_read;
+	}
+	auto out = detail::decoded_chunk{chunk, frames_read};
+	if (silent) {
+		out.data = get_silent_chunk();
+	}
+	else if (frames_read < ads::frame_count{capacity}) {
+		// Stopped short of the size the chunk was allocated at.
+		out.data = copy_chunk_data(th, state.chunk_pool.get(), *chunk, channel_count, frames_read.value);
+	}
+	if (published && out.data.get() != chunk.get()) {
+		set_chunk(th, &shared->chunks, chunk_idx, out.data.get());
+		retire_chunk(th, &state, shared->atomics, std::move(chunk));
+	}
+	return out;
+}
+
+// Playback can go faster than real time, e.g. when a host renders offline,
+// so the loader keeps track of how fast the playhead is moving. The audio
+// thread answers within a buffer of being asked, so each position is taken
+// to be from when it was asked for. The playhead stops while it waits for a
+// chunk, so a slower reading only brings the speed down gradually.
+static
+auto measure_playhead_speed(ez::nort_t, detail::loader_state* state, double pos, std::chrono::steady_clock::time_point asked_at) -> void {
+	const auto seen    = state->seen_playback_pos_at != std::chrono::steady_clock::time_point{};
+	const auto frames  = pos - state->seen_playback_pos;
+	const auto seconds = std::chrono::duration<double>{asked_at - state->seen_playback_pos_at}.count();
+	// Not moving, or jumped backwards because of a seek, says nothing.
+	if (seen && frames > 0.0 && seconds > 0.0) {
+		state->playhead_speed = std::max({frames / seconds, state->playhead_speed * 0.5, state->SR});
+	}
+	state->seen_playback_pos    = pos;
+	state->seen_playback_pos_at = asked_at;
+}
+
+// Asks the audio thread for the playback position again, and returns how
+// old the position it reported last could be. Returns nullopt if the last
+// request hasn't been answered, i.e. the audio thread hasn't run since.
+[[nodiscard]] static
+auto renew_playback_pos_request(ez::nort_t th, detail::loader_state* state, detail::shared_atomics* atomics, std::chrono::steady_clock::time_point now) -> std::optional<std::chrono::steady_clock::duration> {
+	if (atomics->request_playback_pos.exchange(true, std::memory_order_relaxed)) {
+		return std::nullopt;
+	}
+	if (state->playback_pos_requested_at != std::chrono::steady_clock::time_point{}) {
+		measure_playhead_speed(th, state, atomics->reported_playback_pos.load(std::memory_order_relaxed), state->playback_pos_requested_at);
+	}
+	return now - std::exchange(state->playback_pos_requested_at, now);
+}
+
+// When to try again after failing to make room for a chunk. That can only
+// change once the playhead has moved into another chunk, or when another
+// streamer gives bytes back to the budget, which wakes the loader anyway.
+// If the audio thread has stopped there is no telling when it will start
+// again, so the loader checks less often the longer it stays stopped, down
+// to once per chunk's worth of playing time.
+[[nodiscard]] static
+auto get_budget_retry_time(ez::nort_t, const detail::shared_safe& shared, detail::loader_state* state, std::chrono::steady_clock::time_point now, std::optional<std::chrono::steady_clock::duration> pos_age) -> std::chrono::steady_clock::time_point {
+	using duration = std::chrono::steady_clock::duration;
+	const auto seconds = [](double s) { return std::chrono::duration_cast<duration>(std::chrono::duration<double>{s}); };
+	if (!pos_age) {
+		const auto chunk_time = seconds(static_cast<double>(state->chunk_size) / std::max(state->playhead_speed, state->SR));
+		state->stopped_wait = std::min(std::max(state->stopped_wait * 2, duration{LOADER_IDLE_WAIT}), chunk_time);
+		return now + state->stopped_wait;
+	}
+	state->stopped_wait = {};
+	if (state->playhead_speed == 0.0) {
+		// Playing, but it isn't known how fast yet.
+		return now + LOADER_IDLE_WAIT;
+	}
+	const auto reported  = shared.atomics.reported_playback_pos.load(std::memory_order_relaxed);
+	const auto chunk_end = static_cast<double>(get_chunk_beg(state->chunk_size, get_chunk_idx(state->chunk_size, reported) + 1).value);
+	const auto pos       = reported + std::chrono::duration<double>{*pos_age}.count() * state->playhead_speed;
+	if (pos >= chunk_end) {
+		// It has probably got there already. Only the position is out of date.
+		return now + PLAYBACK_POS_WAIT;
+	}
+	return now + std::max(seconds((chunk_end - pos) / state->playhead_speed), duration{PLAYBACK_POS_WAIT});
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto load_next_chunk(ez::nort_t th, detail::loader<Stream, JThread>* loader, detail::shared_safe* shared) -> load_result {
+	auto& state = loader->state;
+	auto model_version = uint64_t{0};
+	(void)has_seek_target_moved(th, &state, shared, &model_version, std::nullopt);
+	const auto now     = std::chrono::steady_clock::now();
+	const auto pos_age = renew_playback_pos_request(th, &state, &shared->atomics, now);
+	free_retired_chunks(th, &state, shared->atomics);
+	const auto next_chunk = get_next_chunk_to_load(*shared, state);
+	if (!next_chunk) {
+		// Entire file has been loaded
+		if (state.retired.empty()) {
+			return load_result::finished;
+		}
+		state.retry_at = now + LOADER_IDLE_WAIT;
+		return load_result::idle;
+	}
+	const auto current_chunk_idx = *next_chunk;
+	if (!make_room(th, &state, shared, current_chunk_idx)) {
+		state.retry_at = get_budget_retry_time(th, *shared, &state, now, pos_age);
+		return load_result::idle;
+	}
+	auto chunk           = find_cached_chunk(th, state.cache, state.cache_identity, state.chunk_size, current_chunk_idx, state.storage_format);
+	auto update_estimate = false;
+	auto approximate     = false;
+	if (!chunk) {
+		chunk = read_disk_cached_chunk(th, state.chunk_pool.get(), state.disk_cache_file.get(), current_chunk_idx);
+		if (!chunk) {
+			// Only chunks read straight on from the start of the stream say
+			// anything about how long it is. Approximate chunks aren't cached
+			// because they will be replaced.
+			approximate     = is_beyond_seek_index(state, current_chunk_idx);
+			update_estimate = state.seek_index.empty() || (!approximate && !state.stream_approximate && state.stream_pos == get_chunk_beg(state.chunk_size, current_chunk_idx));
+			chunk           = decode_chunk(th, loader, shared, model_version, shared->model.read(th), current_chunk_idx, approximate, update_estimate);
+			if (!chunk) {
+				if (is_memory_limited(state)) {
+					release_bytes(th, &state, get_chunk_bytes(state));
+				}
+				return load_result::interrupted;
+			}
+			if (!approximate) {
+				write_disk_cached_chunk(th, state.disk_cache_file.get(), current_chunk_idx, *chunk);
+			}
+		}
+		if (!approximate) {
+			cache_chunk(th, state.cache, state.cache_identity, state.chunk_size, current_chunk_idx, state.storage_format, *chunk);
+		}
+	}
+	if (is_memory_limited(state)) {
+		release_bytes(th, &state, get_chunk_bytes(state) - chunk->data->bytes.size());
+	}
+	const auto frames_read = chunk->frame_count;
+	auto just_found_end_chunk = false;
+	if (frames_read < ads::frame_count{state.chunk_size} && !approximate) {
+		// Must have found the end of the file.
+		state.end_chunk = current_chunk_idx;
+		just_found_end_chunk = true;
+	}
+	const auto end_chunk         = state.end_chunk;
+	const auto chunk_size        = state.chunk_size;
+	const auto total_frames_read = state.total_frames_read;
+	const auto frame_count_known = shared->model.read(th).header.frame_count.has_value();
+	if (just_found_end_chunk || (update_estimate && !frame_count_known)) {
+		publish(th, shared, [=](detail::model x) {
+			if (just_found_end_chunk)                     { x.header.frame_count = get_frame_count_at_end(x.header, calculate_frame_count_from_end_chunk(chunk_size, *end_chunk, frames_read)); }
+			if (update_estimate && !x.header.frame_count) { x.estimated_frame_count = estimate_frame_count(total_frames_read, loader->stream->get_total_bytes_read(), x.header.stream_length); }
+			return x;
+		});
+	}
+	if (state.chunks.size() <= current_chunk_idx) {
+		state.chunks.resize(current_chunk_idx + 1);
+	}
+	if (state.chunks[current_chunk_idx]) {
+		// Replacing an approximate chunk.
+		evict_chunk(th, &state, shared, current_chunk_idx);
+	}
+	state.chunks[current_chunk_idx] = chunk->data;
+	set_chunk(th, &shared->chunks, current_chunk_idx, chunk->data.get());
+	if (approximate) {
+		// Playable, but as far as everything else is concerned, not loaded.
+		state.approximate_chunks.push_back(current_chunk_idx);
+	}
+	else {
+		set_bit(th, &shared->loaded, current_chunk_idx);
+	}
+	if (!can_reload(state)) {
+		state.next_chunk = get_next_chunk_to_load_forward(current_chunk_idx, state.end_chunk);
+	}
+	return load_result::loaded;
+}
+
+// How many seconds until the loader's next chunk will be needed by the
+// playhead. Chunks behind the playhead come after everything in front of it.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto get_load_priority(const detail::loader<Stream, JThread>& loader, const detail::shared_safe& shared) -> double {
+	static constexpr auto BEHIND_PLAYHEAD = 1.0e6;
+	const auto& state     = loader.state;
+	const auto next_chunk = get_next_chunk_to_load(shared, state);
+	if (!next_chunk) {
+		return std::numeric_limits<double>::max();
+	}
+	const auto playback_pos = get_playhead_pos(shared, state);
+	const auto chunk_beg    = static_cast<double>(get_chunk_beg(state.chunk_size, *next_chunk).value);
+	const auto chunk_end    = chunk_beg + static_cast<double>(state.chunk_size);
+	if (playback_pos >= chunk_end) {
+		return BEHIND_PLAYHEAD + (playback_pos - chunk_end) / state.SR;
+	}
+	return std::max(0.0, chunk_beg - playback_pos) / state.SR;
+}
+
+static
+auto signal_wakeup(ez::nort_t, detail::loader_wakeup* x) -> void {
+	{
+		auto lock = std::unique_lock{x->mutex};
+		x->signalled = true;
+	}
+	x->cv.notify_one();
+}
+
+// Returns false if the loader is being destroyed.
+[[nodiscard]] static
+auto wait_for_wakeup(ez::nort_t, detail::loader_wakeup* x, std::chrono::steady_clock::time_point deadline) -> bool {
+	auto lock = std::unique_lock{x->mutex};
+	x->cv.wait_until(lock, deadline, [x] { return x->signalled || x->quit; });
+	x->signalled = false;
+	return !x->quit;
+}
+
+static auto leave_budget(ez::nort_t, detail::budget_usage* usage) -> void;
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread>
+loader<Stream, JThread>::~loader() {
+	leave_budget(ez::nort, &state.usage);
+	// The thread might be waiting for a while, so wake it up before it is
+	// asked to stop and joined.
+	auto lock = std::unique_lock{wakeup.mutex};
+	wakeup.quit = true;
+	wakeup.cv.notify_one();
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken> static
+auto load_proc(StopToken stop, detail::loader<Stream, JThread>* loader, detail::shared_safe* shared) -> void {
+	while (!stop.stop_requested()) {
+		switch (load_next_chunk(ez::nort, loader, shared)) {
+			case load_result::loaded:      { break; }
+			case load_result::interrupted: { break; }
+			case load_result::idle:        { if (!wait_for_wakeup(ez::nort, &loader->wakeup, loader->state.retry_at)) { return; } break; }
+			case load_result::finished:    { return; }
+		}
+	}
+}
+
+// Returns the job with the most urgent chunk which isn't already being
+// worked on or waiting to retry, if there is one.
+[[nodiscard]] static
+auto pick_job(const detail::pool& pool) -> shptr<detail::pool_job> {
+	const auto now     = std::chrono::steady_clock::now();
+	auto best          = shptr<detail::pool_job>{};
+	auto best_priority = std::numeric_limits<double>::max();
+	for (const auto& job : pool.jobs) {
+		if (job->busy || job->done || job->retry_at > now) {
+			continue;
+		}
+		const auto priority = job->get_priority();
+		if (!best || priority < best_priority) {
+			best          = job;
+			best_priority = priority;
+		}
+	}
+	return best;
+}
+
+// The soonest a job which is waiting to retry will be ready, if any are.
+[[nodiscard]] static
+auto get_next_retry_time(const detail::pool& pool) -> std::optional<std::chrono::steady_clock::time_point> {
+	auto out = std::optional<std::chrono::steady_clock::time_point>{};
+	for (const auto& job : pool.jobs) {
+		if (job->busy || job->done) {
+			continue;
+		}
+		if (!out || job->retry_at < *out) {
+			out = job->retry_at;
+		}
+	}
+	return out;
+}
+
+template <typename StopToken> static
+auto pool_proc(StopToken stop, detail::pool* pool) -> void {
+	auto lock = std::unique_lock{pool->mutex};
+	for (;;) {
+		if (pool->quit || stop.stop_requested()) {
+			return;
+		}
+		const auto job = pick_job(*pool);
+		if (!job) {
+			// Sleep until the next job is due to retry, or until something
+			// notifies, e.g. a seek or a job being added.
+			if (const auto retry_at = get_next_retry_time(*pool)) { pool->cv.wait_until(lock, *retry_at); }
+			else                                                  { pool->cv.wait(lock); }
+			continue;
+		}
+		job->busy  = true;
+		job->woken = false;
+		lock.unlock();
+		const auto result = job->load_next_chunk();
+		lock.lock();
+		job->busy = false;
+		job->done = result == load_result::finished;
+		if (result == load_result::idle) {
+			job->retry_at = job->woken ? std::chrono::steady_clock::time_point{} : job->get_retry_at();
+		}
+		pool->cv.notify_all();
+	}
+}
+
+static
+auto retry_jobs_now(ez::nort_t, detail::pool* pool) -> void {
+	auto lock = std::unique_lock{pool->mutex};
+	for (const auto& job : pool->jobs) {
+		job->retry_at = {};
+		job->woken    = true;
+	}
+	pool->cv.notify_all();
+}
+
+static
+auto add_job(ez::nort_t, detail::pool* pool, detail::pool_registration* registration, detail::pool_job job) -> void {
+	registration->pool = pool;
+	registration->job  = make_shptr<detail::pool_job>(std::move(job));
+	auto lock = std::unique_lock{pool->mutex};
+	pool->jobs.push_back(registration->job);
+	pool->cv.notify_all();
+}
+
+inline
+pool_registration::~pool_registration() {
+	if (!pool) {
+		return;
+	}
+	auto lock = std::unique_lock{pool->mutex};
+	pool->cv.wait(lock, [this] { return !job->busy; });
+	std::erase(pool->jobs, job);
+	pool->cv.notify_all();
+}
+
+// Loaders which can't make room for a chunk sleep until the playhead has
+// moved on, but bytes given back by other streamers might be enough, so the
+// budget wakes them up whenever that happens.
+static
+auto join_budget(ez::nort_t, detail::budget_usage* usage, detail::memory_budget* budget, detail::loader_wakeup* wakeup, detail::pool* pool) -> void {
+	auto lock = std::unique_lock{budget->wake_mutex};
+	if (pool) { budget->wake_pools[pool]++; }
+	else      { budget->wake_threads.push_back(wakeup); }
+	usage->budget = budget;
+	usage->wakeup = pool ? nullptr : wakeup;
+	usage->pool   = pool;
+}
+
+static
+auto leave_budget(ez::nort_t, detail::budget_usage* usage) -> void {
+	const auto budget = usage->budget;
+	if (!budget) {
+		return;
+	}
+	auto lock = std::unique_lock{budget->wake_mutex};
+	if (const auto pool = std::exchange(usage->pool, nullptr)) {
+		if (--budget->wake_pools[pool] == 0) {
+			budget->wake_pools.erase(pool);
+		}
+	}
+	if (const auto wakeup = std::exchange(usage->wakeup, nullptr)) {
+		std::erase(budget->wake_threads, wakeup);
+	}
+}
+
+static
+auto wake_budget_users(ez::nort_t th, detail::memory_budget* budget) -> void {
+	auto lock = std::unique_lock{budget->wake_mutex};
+	for (const auto wakeup : budget->wake_threads) {
+		signal_wakeup(th, wakeup);
+	}
+	for (const auto& [pool, count] : budget->wake_pools) {
+		retry_jobs_now(th, pool);
+	}
+}
 
-enum class state {
-	playing,
-	finished
-};
+inline
+budget_usage::~budget_usage() {
+	if (!budget) {
+		return;
+	}
+	budget->used.fetch_sub(bytes, std::memory_order_relaxed);
+	if (bytes > 0) {
+		wake_budget_users(ez::nort, budget);
+	}
+}
 
-struct target {
-	ads::frame_idx seek_pos;
-};
+[[nodiscard]] static auto get_sinc_bank() -> const detail::sinc_bank&;
 
-template <size_t CHUNK_SIZE>
-struct chunk {
-	size_t id = 0; // The ID is also the chunk index.
-	shptr<const ads::data<float, ads::DYNAMIC_EXTENT, CHUNK_SIZE>> data;
-};
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken> static
+auto init(ez::nort_t th, impl<Stream, JThread>* x, Stream stream, detail::loader_options options) -> void {
+	x->loader.stream = make_uptr<Stream>(std::move(stream));
+	x->resampler.buffer.resize(detail::resampler::SCRATCH_SIZE);
+	// Make sure these are initialized before the audio thread needs them.
+	std::ignore = get_isa();
+	std::ignore = get_sinc_bank();
+	auto header = x->loader.stream->get_header();
+	if (header.format == audiorw::format::wav && !options.map_path.empty()) {
+		x->wav = map_wav(th, options.map_path, header);
+	}
+	if (x->wav) {
+		header.frame_count = ads::frame_count{x->wav->frame_count};
+	}
+	const auto chunk_size = choose_chunk_size(header, options.chunk_size, options.default_chunk_size);
+	x->shared.chunks.chunk_size = chunk_size;
+	x->loader.state.chunk_size  = chunk_size;
+	if (x->wav) {
+		// Everything can be played right away, so there's nothing to load.
+		publish(th, &x->shared, make_initial_model(header));
+		for (size_t i = 0; i < get_chunk_count(chunk_size, *header.frame_count); i++) {
+			set_bit(th, &x->shared.loaded, i);
+		}
+		return;
+	}
+	if (header.frame_count) {
+		const auto chunk_count = get_chunk_count(chunk_size, *header.frame_count);
+		reserve_chunks(th, &x->shared.chunks, chunk_count);
+		if (chunk_count > 0) {
+			x->loader.state.end_chunk = chunk_count - 1;
+		}
+	}
+	publish(th, &x->shared, make_initial_model(header));
+	x->loader.state.interleaved.emplace(header.channel_count, ads::frame_count{get_decode_slice_size(header.channel_count)});
+	x->loader.state.SR              = static_cast<double>(header.SR);
+	x->loader.state.can_random_seek = header.format != audiorw::format::mp3;
+	if constexpr (afs::concepts::seek_point_stream<Stream>) {
+		if (!x->loader.state.can_random_seek) {
+			x->loader.state.seek_index.push_back(x->loader.stream->get_seek_point());
+		}
+	}
+	x->loader.state.stream_pos = ads::frame_idx{0};
+	x->loader.state.storage_format  = options.chunk_format;
+	if (options.budget) {
+		join_budget(th, &x->loader.state.usage, options.budget, &x->loader.wakeup, options.pool);
+	}
+	x->loader.state.max_bytes       = options.max_bytes;
+	x->loader.state.cache           = options.cache;
+	x->loader.state.chunk_pool      = options.chunk_pool ? options.chunk_pool->shared_from_this() : nullptr;
+	x->loader.state.cache_identity  = std::move(options.cache_identity);
+	if (options.disk_cache && !x->loader.state.cache_identity.empty() && header.format != audiorw::format::wav) {
+		// Only worth it for formats which are expensive to decode.
+		x->loader.state.disk_cache_file = open_disk_cache_file(th, options.disk_cache, x->loader.state.cache_identity, chunk_size, header.channel_count, options.chunk_format);
+	}
+	if (header.format == audiorw::format::mp3 && !options.map_path.empty()) {
+		x->loader.scan_thread = JThread{scan_proc<StopToken>, &x->shared, options.map_path};
+	}
+	if (const auto pool = options.pool) {
+		auto job = detail::pool_job{
+			.load_next_chunk = [x] { return load_next_chunk(ez::nort, &x->loader, &x->shared); },
+			.get_priority    = [x] { return get_load_priority(x->loader, x->shared); },
+			.get_retry_at    = [x] { return x->loader.state.retry_at; },
+		};
+		add_job(th, pool, &x->loader.pool_registration, std::move(job));
+		return;
+	}
+	x->loader.thread = JThread{load_proc<Stream, JThread, StopToken>, &x->loader, &x->shared};
+}
 
-template <size_t CHUNK_SIZE>
-struct model {
-	immer::table<detail::chunk<CHUNK_SIZE>> loaded_chunks;
-	audiorw::header header;
-	detail::target target;
-	ads::frame_count estimated_frame_count;
-};
+static
+auto report_playback_pos_if_requested(ez::audio_t, detail::servo* servo, detail::shared_atomics* atomics) -> void {
+	if (atomics->request_playback_pos.load(std::memory_order_relaxed)) {
+		atomics->reported_playback_pos.store(servo->playback_pos, std::memory_order_relaxed);
+		atomics->request_playback_pos.store(false, std::memory_order_relaxed);
+	}
+}
 
-struct servo {
-	detail::state state = state::playing;
-	ads::frame_idx playback_beg;
-	double playback_pos = 0.0;
-};
+// If a write is in progress the snapshot is left as it is and picked up on
+// the next call instead, so the audio thread never waits for a writer.
+static
+auto refresh_snapshot(ez::audio_t, detail::snapshot* snapshot, const detail::snapshot_slot& slot) -> void {
+	const auto seq = slot.seq.load(std::memory_order_acquire);
+	if (seq == snapshot->version || seq % 2 == 1) {
+		return;
+	}
+	const auto channel_count         = slot.channel_count.load(std::memory_order_relaxed);
+	const auto SR                    = slot.SR.load(std::memory_order_relaxed);
+	const auto estimated_frame_count = slot.estimated_frame_count.load(std::memory_order_relaxed);
+	const auto frame_count_known     = slot.frame_count_known.load(std::memory_order_relaxed);
+	const auto seek_pos              = slot.seek_pos.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.seq.load(std::memory_order_relaxed) != seq) {
+		return;
+	}
+	snapshot->version               = seq;
+	snapshot->channel_count         = ads::channel_count{static_cast<size_t>(channel_count)};
+	snapshot->SR                    = SR;
+	snapshot->estimated_frame_count = ads::frame_count{estimated_frame_count};
+	snapshot->frame_count_known     = frame_count_known;
+	snapshot->target.seek_pos       = ads::frame_idx{seek_pos};
+}
 
-struct shared_atomics {
-	std::atomic<bool> request_playback_pos    = false;
-	std::atomic<bool> reported_finished       = false;
-	std::atomic<double> reported_playback_pos = 0.0;
-};
+// Where the stream ends, as far as the audio thread is concerned. An
+// estimate can be short, or 0 before the loader has read anything, so a
+// stream whose length isn't known yet doesn't have an end.
+[[nodiscard]] static
+auto get_known_frame_count(const detail::snapshot& model) -> std::optional<ads::frame_count> {
+	if (model.frame_count_known) {
+		return model.estimated_frame_count;
+	}
+	return std::nullopt;
+}
 
-template <size_t CHUNK_SIZE>
-struct shared_safe {
-	ez::sync<model<CHUNK_SIZE>> model;
-	detail::shared_atomics atomics;
-};
+static
+auto finish_if_reached_end(ez::audio_t, detail::servo* servo, detail::shared_atomics* atomics, const detail::snapshot& model) -> void {
+	const auto frame_count = get_known_frame_count(model);
+	if (frame_count && servo->playback_pos >= *frame_count) {
+		servo->state = state::finished;
+		atomics->reported_finished.store(true, std::memory_order_relaxed);
+	}
+}
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread>
-struct loader {
-	uptr<Stream> stream;
-	JThread thread;
-};
+[[nodiscard]] static
+auto detect_isa() -> isa {
+#if AFS_X86
+#	if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return isa::sse;
+	}
+	__cpuid(info, 1);
+	const auto has_fma     = (info[2] & (1 << 12)) != 0;
+	const auto has_osxsave = (info[2] & (1 << 27)) != 0;
+	const auto has_avx     = (info[2] & (1 << 28)) != 0;
+	__cpuidex(info, 7, 0);
+	const auto has_avx2    = (info[1] & (1 << 5)) != 0;
+	if (has_fma && has_osxsave && has_avx && has_avx2 && (_xgetbv(0) & 0x6) == 0x6) {
+		return isa::avx2;
+	}
+	return isa::sse;
+#	else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return isa::avx2;
+	}
+	return isa::sse;
+#	endif
+#else
+	return isa::scalar;
+#endif
+}
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE>
-struct impl {
-	detail::shared_safe<CHUNK_SIZE> shared;
-	detail::loader<Stream, JThread> loader;
-	detail::servo servo;
-};
+[[nodiscard]] static
+auto get_isa() -> isa {
+	static const auto isa = detect_isa();
+	return isa;
+}
 
 [[nodiscard]] static
-auto quantize(auto v, auto step) {
-	return v - (v % step);
+auto bessel_i0(double x) -> double {
+	auto sum  = 1.0;
+	auto term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		const auto y = x / (2.0 * k);
+		term *= y * y;
+		sum  += term;
+	}
+	return sum;
 }
 
-template <size_t CHUNK_SIZE, size_t BUFFER_SIZE> [[nodiscard]] static
-auto fn_seek(ads::frame_idx pos) {
-	return [pos](model<CHUNK_SIZE> x) {
-		x.target.seek_pos = {quantize(pos.value, static_cast<int64_t>(BUFFER_SIZE))};
-		return x;
-	};
+static
+auto make_sinc_table(double ratio, detail::sinc_table* table) -> void {
+	static constexpr auto TAPS   = detail::sinc_table::TAPS;
+	static constexpr auto PHASES = detail::sinc_table::PHASES;
+	static constexpr auto BETA   = 8.0;
+	static constexpr auto CUTOFF = 0.92;
+	static constexpr auto HALF   = static_cast<double>(TAPS / 2);
+	const auto fc = CUTOFF / std::max(1.0, ratio);
+	for (size_t p = 0; p <= PHASES; p++) {
+		const auto frac = static_cast<double>(p) / PHASES;
+		const auto row  = &table->coeffs[p * TAPS];
+		auto sum = 0.0;
+		for (size_t k = 0; k < TAPS; k++) {
+			const auto t = (static_cast<double>(k) - (HALF - 1.0)) - frac;
+			const auto x = t / HALF;
+			const auto w = std::abs(x) < 1.0 ? bessel_i0(BETA * std::sqrt(1.0 - x * x)) / bessel_i0(BETA) : 0.0;
+			const auto s = t == 0.0 ? 1.0 : std::sin(std::numbers::pi * fc * t) / (std::numbers::pi * fc * t);
+			const auto c = fc * s * w;
+			row[k] = static_cast<float>(c);
+			sum   += c;
+		}
+		for (size_t k = 0; k < TAPS; k++) {
+			row[k] = static_cast<float>(row[k] / sum);
+		}
+	}
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto make_initial_model(audiorw::header header) -> model<CHUNK_SIZE> {
-	model<CHUNK_SIZE> out;
-	out.header = header;
+[[nodiscard]] static
+auto make_sinc_bank() -> uptr<detail::sinc_bank> {
+	auto out = make_uptr<detail::sinc_bank>();
+	for (size_t i = 0; i < detail::sinc_bank::RATIOS.size(); i++) {
+		make_sinc_table(detail::sinc_bank::RATIOS[i], &out->tables[i]);
+	}
 	return out;
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto can_seek(const model<CHUNK_SIZE>& x) -> bool {
-	return x.header.frame_count.has_value();
+[[nodiscard]] static
+auto get_sinc_bank() -> const detail::sinc_bank& {
+	static const auto bank = make_sinc_bank();
+	return *bank;
 }
 
-template <size_t CHUNK_SIZE> static
-auto get_chunk_info(const model<CHUNK_SIZE>& x, auto reserve_fn, auto resize_fn, auto set_fn) -> void {
-	reserve_fn(x.loaded_chunks.size() * 2);
-	auto size = size_t{0};
-	for (const auto& chunk : x.loaded_chunks) {
-		if (chunk.id >= size) {
-			size = chunk.id + 1;
-			resize_fn(size, false);
+[[nodiscard]] static
+auto get_sinc_table(double frame_inc) -> const detail::sinc_table& {
+	const auto& bank = get_sinc_bank();
+	for (size_t i = 0; i < detail::sinc_bank::RATIOS.size(); i++) {
+		if (frame_inc <= detail::sinc_bank::RATIOS[i]) {
+			return bank.tables[i];
 		}
-		set_fn(chunk.id, true);
 	}
+	return bank.tables.back();
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_estimated_frame_count(const model<CHUNK_SIZE>& x) -> ads::frame_count {
-	if (x.header.frame_count) {
-		return *x.header.frame_count;
+[[nodiscard]] static
+auto dot_sinc_scalar(const float* a, const float* b, float t, const float* in) -> float {
+	auto sum = 0.0f;
+	for (size_t k = 0; k < detail::sinc_table::TAPS; k++) {
+		sum += (a[k] + t * (b[k] - a[k])) * in[k];
 	}
-	return x.estimated_frame_count;
+	return sum;
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> [[nodiscard]] static
-auto can_seek(ez::nort_t th, const impl<Stream, JThread, CHUNK_SIZE>* x) -> bool {
-	return can_seek(x->shared.model.read(th));
+static
+auto resample_sinc_scalar(const detail::sinc_table& table, const float* in, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	static constexpr auto TAPS   = detail::sinc_table::TAPS;
+	static constexpr auto PHASES = detail::sinc_table::PHASES;
+	for (size_t i = 0; i < frame_count; i++) {
+		const auto ip    = std::floor(pos);
+		const auto phase = (pos - ip) * PHASES;
+		const auto p     = static_cast<size_t>(phase);
+		const auto a     = &table.coeffs[p * TAPS];
+		out[i] = dot_sinc_scalar(a, a + TAPS, static_cast<float>(phase - p), in + static_cast<ptrdiff_t>(ip) - (TAPS / 2 - 1));
+		pos += frame_inc;
+	}
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_chunk_beg(size_t chunk_idx) -> ads::frame_idx {
-	return ads::frame_idx{CHUNK_SIZE} * chunk_idx;
+#if AFS_X86
+[[nodiscard]] static
+auto hsum(__m128 x) -> float {
+	x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+	x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 0x55));
+	return _mm_cvtss_f32(x);
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_chunk_idx(double pos) -> size_t {
-	return static_cast<size_t>(std::floor(pos / CHUNK_SIZE));
+[[nodiscard]] static
+auto dot_sinc_sse(const float* a, const float* b, float t, const float* in) -> float {
+	const auto vt = _mm_set1_ps(t);
+	auto acc = _mm_setzero_ps();
+	for (size_t k = 0; k < detail::sinc_table::TAPS; k += 4) {
+		const auto va = _mm_load_ps(a + k);
+		const auto vb = _mm_load_ps(b + k);
+		const auto vc = _mm_add_ps(va, _mm_mul_ps(vt, _mm_sub_ps(vb, va)));
+		acc = _mm_add_ps(acc, _mm_mul_ps(vc, _mm_loadu_ps(in + k)));
+	}
+	return hsum(acc);
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_chunk_idx(ads::frame_idx fr) -> size_t {
-	return static_cast<size_t>(fr.value / CHUNK_SIZE);
+static
+auto resample_sinc_sse(const detail::sinc_table& table, const float* in, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	static constexpr auto TAPS   = detail::sinc_table::TAPS;
+	static constexpr auto PHASES = detail::sinc_table::PHASES;
+	for (size_t i = 0; i < frame_count; i++) {
+		const auto ip    = std::floor(pos);
+		const auto phase = (pos - ip) * PHASES;
+		const auto p     = static_cast<size_t>(phase);
+		const auto a     = &table.coeffs[p * TAPS];
+		out[i] = dot_sinc_sse(a, a + TAPS, static_cast<float>(phase - p), in + static_cast<ptrdiff_t>(ip) - (TAPS / 2 - 1));
+		pos += frame_inc;
+	}
 }
 
-[[nodiscard]] static
-auto get_next_chunk_to_load_forward(size_t chunk_just_loaded, std::optional<size_t> end_chunk) -> std::optional<size_t> {
-	if (end_chunk && chunk_just_loaded == *end_chunk) {
-		return std::nullopt;
+[[nodiscard]] AFS_TARGET_AVX2 static
+auto dot_sinc_avx2(const float* a, const float* b, float t, const float* in) -> float {
+	const auto vt = _mm256_set1_ps(t);
+	auto acc = _mm256_setzero_ps();
+	for (size_t k = 0; k < detail::sinc_table::TAPS; k += 8) {
+		const auto va = _mm256_load_ps(a + k);
+		const auto vb = _mm256_load_ps(b + k);
+		const auto vc = _mm256_fmadd_ps(vt, _mm256_sub_ps(vb, va), va);
+		acc = _mm256_fmadd_ps(vc, _mm256_loadu_ps(in + k), acc);
 	}
-	return chunk_just_loaded + 1;
+	return hsum(_mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)));
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_next_chunk_to_load_random(const model<CHUNK_SIZE>& x, const detail::shared_safe<CHUNK_SIZE>& shared, std::optional<size_t> end_chunk) -> std::optional<size_t> {
-	const auto playback_pos   = shared.atomics.reported_playback_pos.load(std::memory_order_relaxed);
-	const auto playback_chunk = get_chunk_idx<CHUNK_SIZE>(playback_pos);
-	auto check_chunk = playback_chunk;
-	for (;;) {
-		if (!x.loaded_chunks.find(check_chunk)) {
-			return check_chunk;
-		}
-		check_chunk++;
-		if (end_chunk && check_chunk == *end_chunk) {
-			check_chunk = 0;
-			while (check_chunk < playback_chunk) {
-				if (!x.loaded_chunks.find(check_chunk)) {
-					return check_chunk;
-				}
-				check_chunk++;
-			}
-			return std::nullopt;
-		}
+AFS_TARGET_AVX2 static
+auto resample_sinc_avx2(const detail::sinc_table& table, const float* in, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	static constexpr auto TAPS   = detail::sinc_table::TAPS;
+	static constexpr auto PHASES = detail::sinc_table::PHASES;
+	for (size_t i = 0; i < frame_count; i++) {
+		const auto ip    = std::floor(pos);
+		const auto phase = (pos - ip) * PHASES;
+		const auto p     = static_cast<size_t>(phase);
+		const auto a     = &table.coeffs[p * TAPS];
+		out[i] = dot_sinc_avx2(a, a + TAPS, static_cast<float>(phase - p), in + static_cast<ptrdiff_t>(ip) - (TAPS / 2 - 1));
+		pos += frame_inc;
 	}
-	return std::nullopt;
 }
+#endif
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_next_chunk_to_load(const model<CHUNK_SIZE>& x, const detail::shared_safe<CHUNK_SIZE>& shared, size_t chunk_just_loaded, std::optional<size_t> end_chunk) -> std::optional<size_t> {
-	const auto can_random_seek = x.header.format != audiorw::format::mp3;
-	if (can_random_seek) { return get_next_chunk_to_load_random(x, shared, end_chunk); }
-	else                 { return get_next_chunk_to_load_forward(chunk_just_loaded, end_chunk); }
+static
+auto resample_sinc(const detail::sinc_table& table, const float* in, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	switch (get_isa()) {
+#if AFS_X86
+		case isa::avx2: { return resample_sinc_avx2(table, in, pos, frame_inc, frame_count, out); }
+		case isa::sse:  { return resample_sinc_sse(table, in, pos, frame_inc, frame_count, out); }
+#endif
+		default:        { return resample_sinc_scalar(table, in, pos, frame_inc, frame_count, out); }
+	}
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto calculate_frame_count_from_end_chunk(size_t end_chunk, ads::frame_count frames_in_end_chunk) -> ads::frame_count {
-	return frames_in_end_chunk + ads::frame_count{end_chunk * CHUNK_SIZE};
+static
+auto resample_linear(const float* in, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	for (size_t i = 0; i < frame_count; i++) {
+		const auto ip = std::floor(pos);
+		const auto t  = static_cast<float>(pos - ip);
+		const auto x  = in + static_cast<ptrdiff_t>(ip);
+		out[i] = x[0] + t * (x[1] - x[0]);
+		pos += frame_inc;
+	}
 }
 
 [[nodiscard]] static
-auto estimate_frame_count(ads::frame_count total_frames_read, size_t total_bytes_read, size_t file_size) -> ads::frame_count {
-	const auto byte_progress = static_cast<double>(total_bytes_read) / static_cast<double>(file_size);
-	const auto estimate      = static_cast<double>(total_frames_read.value) / byte_progress;
-	return {static_cast<uint64_t>(estimate)};
+auto get_kernel_reach(afs::interpolation interpolation) -> detail::kernel_reach {
+	switch (interpolation) {
+		case afs::interpolation::sinc: { return {detail::sinc_table::TAPS / 2 - 1, detail::sinc_table::TAPS / 2}; }
+		default:                       { return {0, 1}; }
+	}
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE> static
-auto load_proc(StopToken stop, detail::loader<Stream, JThread>* loader, detail::shared_safe<CHUNK_SIZE>* shared) -> void {
-	auto th                      = ez::nort;
-	auto current_chunk_idx       = size_t{0};
-	auto model                   = shared->model.read(th);
-	auto channel_count           = model.header.channel_count;
-	auto end_chunk               = std::optional<size_t>{};
-	auto interleaved             = ads::interleaved<float>{channel_count, {CHUNK_SIZE}};
-	auto interleaved_buffer_size = interleaved.get_frame_count().value * interleaved.get_channel_count().value;
-	auto total_frames_read       = ads::frame_count{0};
-	for (;;) {
-		if (stop.stop_requested()) {
-			return;
+// Copy frames [beg, end) of one channel into a contiguous buffer. Frames
+// which are out of range or not loaded yet are read as silence. If the
+// frame count isn't known, everything which is loaded is in range.
+static
+auto gather(ez::audio_t th, const detail::chunk_dir& chunks, std::optional<ads::frame_count> frame_count, ads::channel_idx ch, int64_t beg, int64_t end, float* out) -> void {
+	const auto valid_end = frame_count ? static_cast<int64_t>(frame_count->value) : std::numeric_limits<int64_t>::max();
+	while (beg < end) {
+		if (beg < 0 || beg >= valid_end) {
+			const auto run = (beg < 0 ? std::min(end, int64_t{0}) : end) - beg;
+			std::fill_n(out, run, 0.0f);
+			out += run;
+			beg += run;
+			continue;
 		}
-		shared->atomics.request_playback_pos.store(true, std::memory_order_relaxed);
-		loader->stream->seek(get_chunk_beg<CHUNK_SIZE>(current_chunk_idx));
-		auto span = std::span{interleaved.data(), interleaved_buffer_size};
-		const auto frames_read = loader->stream->read_frames(span);
-		total_frames_read += frames_read;
-		auto just_found_end_chunk = false;
-		if (frames_read < ads::frame_count{CHUNK_SIZE}) {
-			// Must have found the end of the file.
-			end_chunk = current_chunk_idx;
-			just_found_end_chunk = true;
-		}
-		auto chunk_data = make_shptr<ads::data<float, ads::DYNAMIC_EXTENT, CHUNK_SIZE>>(ads::make<float, CHUNK_SIZE>(channel_count));
-		ads::deinterleave(interleaved, chunk_data->begin());
-		auto chunk = detail::chunk<CHUNK_SIZE>{
-			.id   = current_chunk_idx,
-			.data = chunk_data
-		};
-		model = shared->model.update_publish(th, [=](detail::model<CHUNK_SIZE> x) {
-			x.loaded_chunks = x.loaded_chunks.insert(chunk);
-			if (just_found_end_chunk)  { x.header.frame_count = x.header.frame_count.value_or(calculate_frame_count_from_end_chunk<CHUNK_SIZE>(*end_chunk, frames_read)); }
-			if (!x.header.frame_count) { x.estimated_frame_count = estimate_frame_count(total_frames_read, loader->stream->get_total_bytes_read(), x.header.stream_length); }
-			return x;
-		});
-		const auto next_chunk_to_load = get_next_chunk_to_load(model, *shared, current_chunk_idx, end_chunk);
-		if (!next_chunk_to_load.has_value()) {
-			// Entire file has been loaded
-			return;
+		const auto chunk_idx = get_chunk_idx(chunks.chunk_size, ads::frame_idx{beg});
+		const auto local_fr  = get_local_chunk_frame(chunks.chunk_size, ads::frame_idx{beg});
+		const auto run       = std::min({end, valid_end, get_chunk_beg(chunks.chunk_size, chunk_idx + 1).value}) - beg;
+		const auto chunk     = find_chunk(th, chunks, chunk_idx);
+		// The model might not say where the file ends yet even though the
+		// last chunk is loaded, and the chunk might still be being decoded,
+		// so only read what is there.
+		const auto ready     = chunk && !chunk->silent ? get_ready_range(*chunk) : ready_range{};
+		const auto lead      = std::clamp(static_cast<int64_t>(ready.beg) - local_fr.value, int64_t{0}, run);
+		const auto chunk_run = std::clamp(static_cast<int64_t>(ready.end) - local_fr.value - lead, int64_t{0}, run - lead);
+		std::fill_n(out, lead, 0.0f);
+		if (chunk_run > 0) {
+			const auto stride = get_bytes_per_sample(chunk->format);
+			read_samples(chunk->format, get_channel_data(*chunk, ch) + (local_fr.value + lead) * stride, stride, chunk_run, out + lead);
 		}
-		current_chunk_idx = *next_chunk_to_load;
+		std::fill_n(out + lead + chunk_run, run - lead - chunk_run, 0.0f);
+		out += run;
+		beg += run;
 	}
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE> static
-auto init(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x, Stream stream) -> void {
-	x->loader.stream = make_uptr<Stream>(std::move(stream));
-	x->loader.thread = JThread{load_proc<Stream, JThread, StopToken, CHUNK_SIZE>, &x->loader, &x->shared};
-	x->shared.model.set_publish(th, make_initial_model<CHUNK_SIZE>(x->loader.stream->get_header()));
-}
-
+// Like gather() for chunks, but converts the frames straight out of the
+// WAV mapping.
 static
-auto report_playback_pos_if_requested(ez::audio_t, detail::servo* servo, detail::shared_atomics* atomics, double pos) -> void {
-	if (atomics->request_playback_pos.load(std::memory_order_relaxed)) {
-		atomics->reported_playback_pos.store(servo->playback_pos, std::memory_order_relaxed);
-		atomics->request_playback_pos.store(false, std::memory_order_relaxed);
-	}
+auto gather(ez::audio_t, const detail::mapped_wav& wav, std::optional<ads::frame_count> frame_count, ads::channel_idx ch, int64_t beg, int64_t end, float* out) -> void {
+	const auto valid_end = static_cast<int64_t>(std::min(frame_count.value_or(ads::frame_count{wav.frame_count}).value, wav.frame_count));
+	const auto lead      = std::clamp(-beg, int64_t{0}, end - beg);
+	std::fill_n(out, lead, 0.0f);
+	out += lead;
+	beg += lead;
+	const auto run = std::max(std::min(end, valid_end) - beg, int64_t{0});
+	read_samples(wav.format, wav.frames + beg * wav.block_align + ch.value * wav.bytes_per_sample, wav.block_align, run, out);
+	std::fill_n(out + run, end - beg - run, 0.0f);
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_local_chunk_frame(double fr) -> float {
-	return static_cast<float>(std::fmod(fr, static_cast<double>(CHUNK_SIZE)));
+// Whether the frame under the playhead can be played yet.
+[[nodiscard]] static
+auto is_ready(ez::audio_t th, const detail::chunk_dir& chunks, double pos) -> bool {
+	const auto chunk = find_chunk(th, chunks, get_chunk_idx(chunks.chunk_size, pos));
+	if (!chunk) {
+		return false;
+	}
+	// If the playhead catches up with a chunk which is still being decoded,
+	// wait for it.
+	const auto ready    = get_ready_range(*chunk);
+	const auto local_fr = static_cast<size_t>(get_local_chunk_frame(chunks.chunk_size, ads::frame_idx{static_cast<int64_t>(pos)}).value);
+	return chunk->silent || (ready.beg == 0 && ready.end == chunk->frame_count) || (ready.beg <= local_fr && local_fr < ready.end);
 }
 
-template <size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_local_chunk_frame(ads::frame_idx fr) -> ads::frame_idx {
-	return {fr.value % CHUNK_SIZE};
+[[nodiscard]] static
+auto is_ready(ez::audio_t, const detail::mapped_wav&, double) -> bool {
+	return true;
 }
 
-template <size_t CHUNK_SIZE> static
-auto finish_if_reached_end(ez::audio_t, detail::servo* servo, detail::shared_atomics* atomics, detail::model<CHUNK_SIZE> model) -> void {
-	if (servo->playback_pos >= get_estimated_frame_count(model)) {
-		servo->state = state::finished;
-		atomics->reported_finished.store(true, std::memory_order_relaxed);
+// Resamples as many frames as the scratch buffer has room for the input
+// of.
+static
+auto resample_block(ez::audio_t th, const auto& source, const detail::snapshot& model, detail::resampler* resampler, afs::interpolation interpolation, ads::channel_idx ch, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	const auto reach = get_kernel_reach(interpolation);
+	const auto ip    = std::floor(pos);
+	const auto beg   = static_cast<int64_t>(ip) - reach.before;
+	const auto end   = static_cast<int64_t>(std::floor(pos + (frame_count - 1) * frame_inc)) + reach.after + 1;
+	const auto in    = resampler->buffer.data() + reach.before;
+	gather(th, source, get_known_frame_count(model), ch, beg, end, resampler->buffer.data());
+	switch (interpolation) {
+		case afs::interpolation::sinc: { return resample_sinc(get_sinc_table(frame_inc), in, pos - ip, frame_inc, frame_count, out); }
+		default:                       { return resample_linear(in, pos - ip, frame_inc, frame_count, out); }
 	}
 }
 
-template <size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto playback_single_chunk(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, detail::model<CHUNK_SIZE> model, size_t chunk_idx, double SR, double frame_inc, output_signal signal) -> void {
-	if (const auto chunk = model.loaded_chunks.find(chunk_idx)) {
-		for (ads::channel_idx ch; ch < std::min(ads::channel_count{2}, model.header.channel_count); ch++) {
-			auto& signal_row = signal.at(ch.value);
-			auto fr          = servo->playback_pos;
-			for (int i = 0; i < BUFFER_SIZE; i++) {
-				signal_row[i] = chunk->data->at(ch, get_local_chunk_frame<CHUNK_SIZE>(fr));
-				fr += frame_inc;
-			}
-		}
-		servo->playback_pos += BUFFER_SIZE * frame_inc;
-		finish_if_reached_end(th, servo, atomics, model);
+// source is either a chunk_dir or a mapped_wav. frame_count is either a
+// size_t or a std::integral_constant. If it is a constant and the frames
+// fit in one block, the constant reaches the interpolation kernels' loops.
+static
+auto resample(ez::audio_t th, const auto& source, const detail::snapshot& model, detail::resampler* resampler, afs::interpolation interpolation, ads::channel_idx ch, double pos, double frame_inc, auto frame_count, float* out) -> void {
+	if (frame_inc == 1.0 && pos == std::floor(pos)) {
+		// Unity rate on a whole frame, so nothing to interpolate. Copy the
+		// frames straight out of the chunks.
+		const auto beg = static_cast<int64_t>(pos);
+		gather(th, source, get_known_frame_count(model), ch, beg, beg + static_cast<int64_t>(frame_count), out);
+		return;
+	}
+	const auto reach     = get_kernel_reach(interpolation);
+	const auto max_span  = static_cast<double>(detail::resampler::SCRATCH_SIZE - reach.before - reach.after - 2);
+	const auto max_block = static_cast<size_t>(max_span / frame_inc) + 1;
+	if (frame_count <= max_block) {
+		resample_block(th, source, model, resampler, interpolation, ch, pos, frame_inc, frame_count, out);
+		return;
 	}
-	if (model.header.channel_count < 2) {
-		std::ranges::copy_n(signal.at(0), BUFFER_SIZE, signal.at(1));
+	auto frames_left = static_cast<size_t>(frame_count);
+	while (frames_left > 0) {
+		const auto block_size = std::min(frames_left, max_block);
+		resample_block(th, source, model, resampler, interpolation, ch, pos, frame_inc, block_size, out);
+		pos         += block_size * frame_inc;
+		out         += block_size;
+		frames_left -= block_size;
 	}
 }
 
-template <size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto playback_chunk_transition(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, detail::model<CHUNK_SIZE> model, size_t chunk_idx, double SR, double frame_inc, output_signal signal) -> void {
-	for (ads::channel_idx ch; ch < std::min(ads::channel_count{2}, model.header.channel_count); ch++) {
-		auto& signal_row = signal.at(ch.value);
-		auto fr          = servo->playback_pos;
-		for (int i = 0; i < BUFFER_SIZE; i++) {
-			const auto fr_a = ads::frame_idx{static_cast<int64_t>(std::floor(fr))};
-			const auto fr_b = ads::frame_idx{static_cast<int64_t>(std::ceil(fr))};
-			const auto fr_t = static_cast<float>(fr - std::floor(fr));
-			const auto chunk_a = model.loaded_chunks.find(get_chunk_idx<CHUNK_SIZE>(fr_a));
-			const auto chunk_b = model.loaded_chunks.find(get_chunk_idx<CHUNK_SIZE>(fr_b));
-			const auto value_a = chunk_a ? chunk_a->data->at(ch, get_local_chunk_frame<CHUNK_SIZE>(fr_a)) : 0.0f;
-			const auto value_b = chunk_b ? chunk_b->data->at(ch, get_local_chunk_frame<CHUNK_SIZE>(fr_b)) : 0.0f;
-			signal_row[i] = std::lerp(value_a, value_b, fr_t);
-			fr += frame_inc;
-		}
+static
+auto playback_frames(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, const auto& source, const detail::snapshot& model, detail::resampler* resampler, double frame_inc, output_signal signal, auto frame_count) -> void {
+	const auto interpolation = atomics->interpolation.load(std::memory_order_relaxed);
+	for (ads::channel_idx ch; ch < std::min(ads::channel_count{2}, model.channel_count); ch++) {
+		resample(th, source, model, resampler, interpolation, ch, servo->playback_pos, frame_inc, frame_count, signal.at(ch.value));
 	}
-	if (model.header.channel_count < 2) {
-		std::ranges::copy_n(signal.at(0), BUFFER_SIZE, signal.at(1));
+	if (model.channel_count < 2) {
+		std::ranges::copy_n(signal.at(0), frame_count, signal.at(1));
 	}
-	servo->playback_pos += BUFFER_SIZE * frame_inc;
+	servo->playback_pos += frame_count * frame_inc;
 	finish_if_reached_end(th, servo, atomics, model);
 }
 
-template <size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto playback_frames(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, detail::model<CHUNK_SIZE> model, size_t chunk_beg, size_t chunk_end, double SR, double frame_inc, output_signal signal) -> void {
-	if (chunk_beg == chunk_end) { return playback_single_chunk<CHUNK_SIZE, BUFFER_SIZE>(th, servo, atomics, model, chunk_beg, SR, frame_inc, signal); }
-	else                        { return playback_chunk_transition<CHUNK_SIZE, BUFFER_SIZE>(th, servo, atomics, model, chunk_beg, SR, frame_inc, signal); }
-}
-
-template <size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto process_playback(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, detail::model<CHUNK_SIZE> model, double SR, output_signal signal) -> void {
+static
+auto process_playback(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, const auto& source, const detail::snapshot& model, detail::resampler* resampler, double SR, output_signal signal, auto frame_count) -> void {
 	if (model.target.seek_pos != servo->playback_beg) {
 		servo->playback_beg   = model.target.seek_pos;
 		servo->playback_pos   = static_cast<double>(model.target.seek_pos.value);
+		// The loader needs to know about this whether it asked or not. Until
+		// it sees the target here it takes the playhead to be at the target.
+		atomics->reported_playback_pos.store(servo->playback_pos, std::memory_order_relaxed);
+		atomics->reported_playback_beg.store(servo->playback_beg.value, std::memory_order_release);
 	}
-	const auto frame_inc = static_cast<double>(model.header.SR) / SR;
-	const auto fr_beg = servo->playback_pos;
-	const auto fr_end = servo->playback_pos + (64 * frame_inc);
-	const auto chunk_beg = get_chunk_idx<CHUNK_SIZE>(fr_beg);
-	const auto chunk_end = get_chunk_idx<CHUNK_SIZE>(fr_end);
-	playback_frames<CHUNK_SIZE, BUFFER_SIZE>(th, servo, atomics, model, chunk_beg, chunk_end, SR, frame_inc, signal);
-	report_playback_pos_if_requested(th, servo, atomics, servo->playback_pos);
+	const auto frame_inc = model.SR / SR;
+	if (is_ready(th, source, servo->playback_pos)) {
+		playback_frames(th, servo, atomics, source, model, resampler, frame_inc, signal, frame_count);
+	}
+	else {
+		// The chunk under the playhead isn't loaded yet so wait for it.
+		std::fill_n(signal.at(0), frame_count, 0.0f);
+		std::fill_n(signal.at(1), frame_count, 0.0f);
+	}
+	report_playback_pos_if_requested(th, servo, atomics);
 }
 
-template <size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto process(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, detail::model<CHUNK_SIZE> model, double SR, output_signal signal) -> void {
+static
+auto process(ez::audio_t th, detail::servo* servo, detail::shared_atomics* atomics, const auto& source, const detail::snapshot& model, detail::resampler* resampler, double SR, output_signal signal, auto frame_count) -> void {
 	switch (servo->state) {
-		case state::playing: { return process_playback<CHUNK_SIZE, BUFFER_SIZE>(th, servo, atomics, model, SR, signal); }
+		case state::playing: { return process_playback(th, servo, atomics, source, model, resampler, SR, signal, frame_count); }
 		case state::finished:{ return; }
 		default:             { assert (false); return; }
 	}
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto process(ez::audio_t th, impl<Stream, JThread, CHUNK_SIZE>* x, double SR, output_signal signal) -> void {
-	return process<CHUNK_SIZE, BUFFER_SIZE>(th, &x->servo, &x->shared.atomics, *x->shared.model.read(th), SR, signal);
+// Calls fn with the frame count as a compile-time constant if it is one of
+// the common block sizes, otherwise as a plain size_t.
+static
+auto with_frame_count(size_t frame_count, auto fn) -> void {
+	switch (frame_count) {
+		case 32:   { return fn(std::integral_constant<size_t, 32>{}); }
+		case 64:   { return fn(std::integral_constant<size_t, 64>{}); }
+		case 128:  { return fn(std::integral_constant<size_t, 128>{}); }
+		case 256:  { return fn(std::integral_constant<size_t, 256>{}); }
+		case 512:  { return fn(std::integral_constant<size_t, 512>{}); }
+		case 1024: { return fn(std::integral_constant<size_t, 1024>{}); }
+		default:   { return fn(frame_count); }
+	}
+}
+
+// frame_count is either a size_t or a std::integral_constant.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto process(ez::audio_t th, impl<Stream, JThread>* x, double SR, output_signal signal, auto frame_count) -> void {
+	// Evicted chunks aren't freed until the epoch has moved on from the one
+	// they were evicted in.
+	x->shared.atomics.audio_epoch.fetch_add(1, std::memory_order_seq_cst);
+	refresh_snapshot(th, &x->snapshot, x->shared.published);
+	if (x->wav) { process(th, &x->servo, &x->shared.atomics, *x->wav, x->snapshot, &x->resampler, SR, signal, frame_count); }
+	else        { process(th, &x->servo, &x->shared.atomics, x->shared.chunks, x->snapshot, &x->resampler, SR, signal, frame_count); }
+	x->shared.atomics.audio_epoch.fetch_add(1, std::memory_order_release);
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto process(ez::audio_t th, impl<Stream, JThread>* x, double SR, output_signal signal, ads::frame_count frame_count) -> void {
+	return with_frame_count(static_cast<size_t>(frame_count.value), [=](auto frame_count) {
+		process(th, x, SR, signal, frame_count);
+	});
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto get_chunk_info(ez::nort_t th, impl<Stream, JThread>* x, auto reserve_fn, auto resize_fn, auto set_fn) -> void {
+	const auto& loaded = x->shared.loaded;
+	const auto size    = loaded.size.load(std::memory_order_acquire);
+	reserve_fn(size);
+	resize_fn(size, false);
+	for (size_t word_idx = 0; word_idx * 64 < size; word_idx++) {
+		auto word = get_word(loaded, word_idx);
+		while (word) {
+			const auto bit = static_cast<size_t>(std::countr_zero(word));
+			set_fn(word_idx * 64 + bit, true);
+			word &= word - 1;
+		}
+	}
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto get_chunk_bitmap(ez::nort_t th, const impl<Stream, JThread>* x, std::vector<uint64_t>* out) -> size_t {
+	return get_chunk_bitmap(th, x->shared.loaded, out);
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto get_chunk_size(ez::nort_t th, const impl<Stream, JThread>* x) -> size_t {
+	return x->shared.chunks.chunk_size;
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> static
-auto get_chunk_info(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x, auto reserve_fn, auto resize_fn, auto set_fn) -> void {
-	return get_chunk_info(x->shared.model.read(th), reserve_fn, resize_fn, set_fn);
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto get_loader_stats(ez::nort_t, const impl<Stream, JThread>* x) -> afs::loader_stats {
+	auto out = afs::loader_stats{};
+	out.chunks_decoded = x->shared.atomics.chunks_decoded.load(std::memory_order_relaxed);
+	out.stream_seeks   = x->shared.atomics.stream_seeks.load(std::memory_order_relaxed);
+	return out;
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_estimated_frame_count(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x) -> ads::frame_count {
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto get_estimated_frame_count(ez::nort_t th, impl<Stream, JThread>* x) -> ads::frame_count {
 	return get_estimated_frame_count(x->shared.model.read(th));
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> [[nodiscard]] static
-auto is_playing(ez::nort_t th, const impl<Stream, JThread, CHUNK_SIZE>* x) -> bool {
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto is_playing(ez::nort_t, const impl<Stream, JThread>* x) -> bool {
 	return !x->shared.atomics.reported_finished.load(std::memory_order_relaxed);
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_header(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x) -> audiorw::header {
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto get_header(ez::nort_t th, impl<Stream, JThread>* x) -> audiorw::header {
 	return x->shared.model.read(th).header;
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> [[nodiscard]] static
-auto get_playback_pos(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x) -> double {
+template <audiorw::concepts::item_input_stream Stream, typename JThread> [[nodiscard]] static
+auto get_playback_pos(ez::nort_t th, impl<Stream, JThread>* x) -> double {
 	return x->shared.atomics.reported_playback_pos.load(std::memory_order_relaxed);
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE, size_t BUFFER_SIZE> static
-auto seek(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x, ads::frame_idx pos) -> void {
-	x->shared.model.update_publish(th, fn_seek<CHUNK_SIZE, BUFFER_SIZE>(pos));
+// Gets an idle loader to look at the model again now rather than when it
+// next wakes up by itself.
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto wake_loader(ez::nort_t th, impl<Stream, JThread>* x) -> void {
+	auto& registration = x->loader.pool_registration;
+	if (const auto pool = registration.pool) {
+		auto lock = std::unique_lock{pool->mutex};
+		registration.job->retry_at = {};
+		registration.job->woken    = true;
+		pool->cv.notify_all();
+		return;
+	}
+	signal_wakeup(th, &x->loader.wakeup);
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto seek(ez::nort_t th, impl<Stream, JThread>* x, ads::frame_idx pos) -> void {
+	publish(th, &x->shared, fn_seek(pos));
+	wake_loader(th, x);
 }
 
-template <audiorw::concepts::item_input_stream Stream, typename JThread, size_t CHUNK_SIZE> static
-auto request_playback_pos(ez::nort_t th, impl<Stream, JThread, CHUNK_SIZE>* x) -> void {
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto request_playback_pos(ez::nort_t, impl<Stream, JThread>* x) -> void {
 	x->shared.atomics.request_playback_pos.store(true, std::memory_order_relaxed);
 }
 
+template <audiorw::concepts::item_input_stream Stream, typename JThread> static
+auto set_interpolation(ez::nort_t, impl<Stream, JThread>* x, afs::interpolation interpolation) -> void {
+	x->shared.atomics.interpolation.store(interpolation, std::memory_order_relaxed);
+}
+
 } // afs::detail
 
 namespace afs {
 
+template <typename JThread, typename StopToken>
+struct loader_pool {
+	loader_pool(ez::nort_t, size_t thread_count);
+	~loader_pool();
+	[[nodiscard]] auto get_impl(ez::nort_t) -> detail::pool*;
+private:
+	uptr<detail::pool> impl_;
+	std::vector<JThread> threads_;
+};
+
+template <typename JThread, typename StopToken>
+loader_pool<JThread, StopToken>::loader_pool(ez::nort_t, size_t thread_count)
+	: impl_{make_uptr<detail::pool>()}
+{
+	for (size_t i = 0; i < thread_count; i++) {
+		threads_.emplace_back(detail::pool_proc<StopToken>, impl_.get());
+	}
+}
+
+template <typename JThread, typename StopToken>
+loader_pool<JThread, StopToken>::~loader_pool() {
+	auto lock = std::unique_lock{impl_->mutex};
+	impl_->quit = true;
+	impl_->cv.notify_all();
+}
+
+template <typename JThread, typename StopToken>
+auto loader_pool<JThread, StopToken>::get_impl(ez::nort_t) -> detail::pool* {
+	return impl_.get();
+}
+
+struct chunk_cache {
+	chunk_cache(ez::nort_t, size_t max_bytes);
+	[[nodiscard]] auto get_impl(ez::nort_t) -> detail::chunk_cache*;
+private:
+	uptr<detail::chunk_cache> impl_;
+};
+
+inline
+chunk_cache::chunk_cache(ez::nort_t, size_t max_bytes)
+	: impl_{make_uptr<detail::chunk_cache>()}
+{
+	impl_->max_bytes = max_bytes;
+}
+
+inline
+auto chunk_cache::get_impl(ez::nort_t) -> detail::chunk_cache* {
+	return impl_.get();
+}
+
+// Identifies a file by its path, size and modification time, so that a
+// file which has been changed on disk doesn't hit stale cached chunks.
+// Returns an empty string if the file can't be examined.
+[[nodiscard]] inline
+auto make_file_identity(const std::filesystem::path& path) -> std::string {
+	auto ec = std::error_code{};
+	const auto size  = std::filesystem::file_size(path, ec);
+	if (ec) { return {}; }
+	const auto mtime = std::filesystem::last_write_time(path, ec);
+	if (ec) { return {}; }
+	return path.generic_string() + '|' + std::to_string(size) + '|' + std::to_string(mtime.time_since_epoch().count());
+}
+
+// A limit on the memory used by the chunks of any number of streamers. It
+// has to outlive the streamers using it.
+struct memory_budget {
+	memory_budget(ez::nort_t, size_t max_bytes);
+	[[nodiscard]] auto get_impl(ez::nort_t) -> detail::memory_budget*;
+	[[nodiscard]] auto used(ez::nort_t) const -> size_t; // Bytes of chunk data held by the streamers using the budget.
+private:
+	uptr<detail::memory_budget> impl_;
+};
+
+inline
+memory_budget::memory_budget(ez::nort_t, size_t max_bytes)
+	: impl_{make_uptr<detail::memory_budget>()}
+{
+	impl_->max_bytes = max_bytes;
+}
+
+inline
+auto memory_budget::get_impl(ez::nort_t) -> detail::memory_budget* {
+	return impl_.get();
+}
+
+inline
+auto memory_budget::used(ez::nort_t) const -> size_t {
+	return impl_->used.load(std::memory_order_relaxed);
+}
+
+struct disk_cache {
+	disk_cache(ez::nort_t, std::filesystem::path dir);
+	[[nodiscard]] auto get_impl(ez::nort_t) -> detail::disk_cache*;
+private:
+	uptr<detail::disk_cache> impl_;
+};
+
+inline
+disk_cache::disk_cache(ez::nort_t, std::filesystem::path dir)
+	: impl_{make_uptr<detail::disk_cache>()}
+{
+	impl_->dir = std::move(dir);
+}
+
+inline
+auto disk_cache::get_impl(ez::nort_t) -> detail::disk_cache* {
+	return impl_.get();
+}
+
+struct chunk_pool {
+	chunk_pool(ez::nort_t, size_t max_bytes);
+	[[nodiscard]] auto get_impl(ez::nort_t) -> detail::chunk_pool*;
+private:
+	shptr<detail::chunk_pool> impl_;
+};
+
+inline
+chunk_pool::chunk_pool(ez::nort_t, size_t max_bytes)
+	: impl_{make_shptr<detail::chunk_pool>()}
+{
+	impl_->max_bytes = max_bytes;
+}
+
+inline
+auto chunk_pool::get_impl(ez::nort_t) -> detail::chunk_pool* {
+	return impl_.get();
+}
+
+template <typename JThread, typename StopToken>
+struct streamer_options {
+	loader_pool<JThread, StopToken>* pool = nullptr;     // Load on this pool instead of a dedicated thread.
+	afs::memory_budget* budget = nullptr;                // Evict chunks to stay within this shared budget.
+	size_t max_bytes = 0;                                // Evict chunks to stay within this many bytes. 0 means no limit.
+	chunk_cache* cache = nullptr;                        // Share decoded chunks with other streamers of the same file.
+	afs::disk_cache* disk_cache = nullptr;               // Keep decoded chunks of compressed files on disk for next time.
+	afs::chunk_pool* chunk_pool = nullptr;               // Reuse the memory of freed chunks.
+	std::string cache_identity = {};                     // Identifies the file in the cache, e.g. make_file_identity(path).
+	std::filesystem::path map_path = {};                 // If this is an uncompressed WAV file, play it straight from a memory mapping. If it is an MP3, scan it for its length.
+	sample_format chunk_format = sample_format::float32; // How loaded chunks are stored.
+	size_t chunk_size = 0;                               // Frames per chunk. 0 picks one from the file's length, starting from CHUNK_SIZE.
+};
+
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
 struct streamer {
 	streamer(ez::nort_t, Stream stream);
+	streamer(ez::nort_t, Stream stream, loader_pool<JThread, StopToken>* pool);
+	streamer(ez::nort_t, Stream stream, streamer_options<JThread, StopToken> options);
 	[[nodiscard]] auto get_estimated_frame_count(ez::nort_t) const -> ads::frame_count;
 	[[nodiscard]] auto get_header(ez::nort_t) const -> audiorw::header;
 	[[nodiscard]] auto get_playback_pos(ez::ui_t) -> double;
 	[[nodiscard]] auto is_playing(ez::nort_t) const -> bool;
 	auto get_chunk_info(ez::nort_t, auto reserve_fn, auto resize_fn, auto set_fn) const -> void;
+	auto get_chunk_bitmap(ez::nort_t, std::vector<uint64_t>* out) const -> size_t;
+	[[nodiscard]] auto get_chunk_size(ez::nort_t) const -> size_t;
+	[[nodiscard]] auto get_loader_stats(ez::nort_t) const -> loader_stats;
 	auto process(ez::audio_t, double SR, output_signal stereo_out) -> void;
+	auto process(ez::audio_t, double SR, output_signal stereo_out, ads::frame_count frame_count) -> void;
 	auto request_playback_pos(ez::nort_t) -> void;
 	auto seek(ez::nort_t, ads::frame_idx pos) -> void;
+	auto set_interpolation(ez::nort_t, interpolation interpolation) -> void;
 private:
-	uptr<detail::impl<Stream, JThread, CHUNK_SIZE>> impl_;
+	uptr<detail::impl<Stream, JThread>> impl_;
 };
 
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
 streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::streamer(ez::nort_t th, Stream stream)
-	: impl_{std::make_unique<detail::impl<Stream, JThread, CHUNK_SIZE>>()}
+	: streamer{th, std::move(stream), streamer_options<JThread, StopToken>{}}
+{
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::streamer(ez::nort_t th, Stream stream, loader_pool<JThread, StopToken>* pool)
+	: streamer{th, std::move(stream), streamer_options<JThread, StopToken>{.pool = pool}}
+{
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::streamer(ez::nort_t th, Stream stream, streamer_options<JThread, StopToken> options)
+	: impl_{std::make_unique<detail::impl<Stream, JThread>>()}
 {
-	detail::init<Stream, JThread, StopToken>(th, impl_.get(), std::move(stream));
+	auto loader_options = detail::loader_options{
+		.pool               = options.pool ? options.pool->get_impl(th) : nullptr,
+		.budget             = options.budget ? options.budget->get_impl(th) : nullptr,
+		.max_bytes          = options.max_bytes,
+		.cache              = options.cache ? options.cache->get_impl(th) : nullptr,
+		.disk_cache         = options.disk_cache ? options.disk_cache->get_impl(th) : nullptr,
+		.chunk_pool         = options.chunk_pool ? options.chunk_pool->get_impl(th) : nullptr,
+		.cache_identity     = std::move(options.cache_identity),
+		.map_path           = std::move(options.map_path),
+		.chunk_format       = options.chunk_format,
+		.chunk_size         = options.chunk_size,
+		.default_chunk_size = CHUNK_SIZE,
+	};
+	detail::init<Stream, JThread, StopToken>(th, impl_.get(), std::move(stream), std::move(loader_options));
 }
 
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
 auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::process(ez::audio_t th, double SR, output_signal stereo_out) -> void {
-	return detail::process<Stream, JThread, CHUNK_SIZE, BUFFER_SIZE>(th, impl_.get(), SR, stereo_out);
+	return detail::process(th, impl_.get(), SR, stereo_out, std::integral_constant<size_t, BUFFER_SIZE>{});
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::process(ez::audio_t th, double SR, output_signal stereo_out, ads::frame_count frame_count) -> void {
+	return detail::process(th, impl_.get(), SR, stereo_out, frame_count);
 }
 
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
@@ -422,6 +3642,21 @@ auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::get_chunk_in
 	return detail::get_chunk_info(th, impl_.get(), reserve_fn, resize_fn, set_fn);
 }
 
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::get_chunk_bitmap(ez::nort_t th, std::vector<uint64_t>* out) const -> size_t {
+	return detail::get_chunk_bitmap(th, impl_.get(), out);
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::get_chunk_size(ez::nort_t th) const -> size_t {
+	return detail::get_chunk_size(th, impl_.get());
+}
+
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::get_loader_stats(ez::nort_t th) const -> loader_stats {
+	return detail::get_loader_stats(th, impl_.get());
+}
+
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
 auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::get_estimated_frame_count(ez::nort_t th) const -> ads::frame_count {
 	return detail::get_estimated_frame_count(th, impl_.get());
@@ -444,7 +3679,7 @@ auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::is_playing(e
 
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
 auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::seek(ez::nort_t th, ads::frame_idx pos) -> void {
-	return detail::seek<Stream, JThread, CHUNK_SIZE, BUFFER_SIZE>(th, impl_.get(), pos);
+	return detail::seek(th, impl_.get(), pos);
 }
 
 template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
@@ -452,4 +3687,9 @@ auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::request_play
 	return detail::request_playback_pos(th, impl_.get());
 }
 
+template <audiorw::concepts::item_input_stream Stream, typename JThread, typename StopToken, size_t CHUNK_SIZE, size_t BUFFER_SIZE>
+auto streamer<Stream, JThread, StopToken, CHUNK_SIZE, BUFFER_SIZE>::set_interpolation(ez::nort_t th, interpolation interpolation) -> void {
+	return detail::set_interpolation(th, impl_.get(), interpolation);
+}
+
 } // afs
@@ -0,0 +1,78 @@
+// Microbenchmark for the loader's deinterleave-and-convert stage. Times
+// each instruction set against the scalar code. Only the formats with SIMD
+// kernels are timed. The tests check that the kernels match the scalar
+// code. Not run as a test.
+#include "afs.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+static constexpr auto FRAME_COUNT = size_t{4096};
+static constexpr auto REPEATS     = size_t{2000};
+
+[[nodiscard]] static
+auto get_name(afs::detail::isa isa) -> const char* {
+	switch (isa) {
+		case afs::detail::isa::avx2: { return "avx2"; }
+		case afs::detail::isa::sse:  { return "sse"; }
+		default:                     { return "scalar"; }
+	}
+}
+
+[[nodiscard]] static
+auto get_name(afs::sample_format format) -> const char* {
+	switch (format) {
+		case afs::sample_format::int16:   { return "int16"; }
+		case afs::sample_format::float32: { return "float32"; }
+		default:                          { return "?"; }
+	}
+}
+
+[[nodiscard]] static
+auto make_input(size_t channel_count) -> std::vector<float> {
+	auto rng  = std::mt19937{1234};
+	auto dist = std::uniform_real_distribution<float>{-1.1f, 1.1f};
+	auto out  = std::vector<float>(FRAME_COUNT * channel_count);
+	for (auto& x : out) {
+		x = dist(rng);
+	}
+	return out;
+}
+
+// Converts one fewer than FRAME_COUNT frames so that the kernels have a
+// tail to leave to the scalar code.
+[[nodiscard]] static
+auto run(afs::detail::isa isa, afs::sample_format format, const std::vector<float>& in, size_t channel_count, std::vector<std::byte>* out) -> double {
+	const auto frame_count    = FRAME_COUNT - 1;
+	const auto channel_stride = FRAME_COUNT * afs::detail::get_bytes_per_sample(format);
+	const auto t0 = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < REPEATS; i++) {
+		afs::detail::deinterleave_samples(isa, format, in.data(), ads::channel_count{channel_count}, frame_count, out->data(), channel_stride);
+	}
+	const auto t1 = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(t1 - t0).count();
+}
+
+auto main() -> int {
+	auto isas = std::vector{afs::detail::isa::scalar};
+	if (afs::detail::get_isa() != afs::detail::isa::scalar) { isas.push_back(afs::detail::isa::sse); }
+	if (afs::detail::get_isa() == afs::detail::isa::avx2)   { isas.push_back(afs::detail::isa::avx2); }
+	std::printf("%-8s %-3s %-7s %10s %8s\n", "format", "ch", "isa", "Mframes/s", "speedup");
+	for (const auto format : {afs::sample_format::float32, afs::sample_format::int16}) {
+		for (const auto channel_count : {size_t{1}, size_t{2}, size_t{4}, size_t{6}, size_t{8}}) {
+			const auto in    = make_input(channel_count);
+			const auto bytes = FRAME_COUNT * channel_count * afs::detail::get_bytes_per_sample(format);
+			auto out         = std::vector<std::byte>(bytes);
+			auto scalar_time = 0.0;
+			for (const auto isa : isas) {
+				const auto seconds = run(isa, format, in, channel_count, &out);
+				if (isa == afs::detail::isa::scalar) {
+					scalar_time = seconds;
+				}
+				const auto rate = static_cast<double>((FRAME_COUNT - 1) * REPEATS) / seconds / 1.0e6;
+				std::printf("%-8s %-3zu %-7s %10.1f %7.2fx\n", get_name(format), channel_count, get_name(isa), rate, scalar_time / seconds);
+			}
+		}
+	}
+	return 0;
+}
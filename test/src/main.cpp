@@ -1,6 +1,9 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "afs.hpp"
 #include "doctest.h"
+#include <random>
+
+namespace detail = afs::detail;
 
 static const auto TEST_MP3 = std::filesystem::path{ASSETS_DIR} / "test.mp3";
 static const auto TEST_WAV = std::filesystem::path{ASSETS_DIR} / "test.wav";
@@ -17,8 +20,1244 @@ TEST_CASE("compiles") {
 		auto signal        = afs::output_signal{L.data(), R.data()};
 		test_streamer.process(ez::audio, 44100, signal);
 		test_streamer.seek(ez::ui, {100});
+		test_streamer.set_interpolation(ez::ui, afs::interpolation::sinc);
+		test_streamer.process(ez::audio, 48000, signal);
+		test_streamer.process(ez::audio, 48000, signal, ads::frame_count{BUFFER_SIZE / 2});
 		const auto header  = test_streamer.get_header(ez::ui);
 		const auto frs     = test_streamer.get_estimated_frame_count(ez::ui);
 		const auto playing = test_streamer.is_playing(ez::ui);
 	}
 }
+
+TEST_CASE("compiles with loader pool") {
+	static constexpr auto CHUNK_SIZE  = afs::DEFAULT_CHUNK_SIZE;
+	static constexpr auto BUFFER_SIZE = 64;
+	using streamer = afs::streamer<audiorw::stream_item_from_fs_path, std::jthread, std::stop_token, CHUNK_SIZE, BUFFER_SIZE>;
+	auto pool = afs::loader_pool<std::jthread, std::stop_token>{ez::ui, 2};
+	if (const auto format_hint = audiorw::make_format_hint(TEST_WAV, true)) {
+		auto stream = audiorw::stream::item::from(TEST_WAV, *format_hint);
+		auto test_streamer = streamer{ez::ui, std::move(stream), &pool};
+		auto L             = std::array<float, BUFFER_SIZE>{0.0f};
+		auto R             = std::array<float, BUFFER_SIZE>{0.0f};
+		auto signal        = afs::output_signal{L.data(), R.data()};
+		test_streamer.process(ez::audio, 44100, signal);
+	}
+}
+
+TEST_CASE("compiles with memory budget") {
+	static constexpr auto CHUNK_SIZE  = afs::DEFAULT_CHUNK_SIZE;
+	static constexpr auto BUFFER_SIZE = 64;
+	using streamer = afs::streamer<audiorw::stream_item_from_fs_path, std::jthread, std::stop_token, CHUNK_SIZE, BUFFER_SIZE>;
+	auto budget = afs::memory_budget{ez::ui, size_t{1} << 20};
+	CHECK(budget.used(ez::ui) == 0);
+	if (const auto format_hint = audiorw::make_format_hint(TEST_MP3, true)) {
+		auto stream = audiorw::stream::item::from(TEST_MP3, *format_hint);
+		auto test_streamer = streamer{ez::ui, std::move(stream), {.budget = &budget}};
+		auto L             = std::array<float, BUFFER_SIZE>{0.0f};
+		auto R             = std::array<float, BUFFER_SIZE>{0.0f};
+		auto signal        = afs::output_signal{L.data(), R.data()};
+		test_streamer.process(ez::audio, 44100, signal);
+	}
+	CHECK(budget.used(ez::ui) == 0);
+}
+
+TEST_CASE("chunk bitmap find_first and find_last") {
+	static constexpr auto PAGE_BITS = detail::chunk_bitmap::PAGE_WORDS * 64;
+	static constexpr auto CAPACITY  = detail::chunk_bitmap::CAPACITY;
+	auto bitmap = detail::chunk_bitmap{};
+	SUBCASE("empty") {
+		CHECK_FALSE(detail::find_first<true>(bitmap, 0, CAPACITY));
+		CHECK_FALSE(detail::find_last<true>(bitmap, 0, CAPACITY));
+		CHECK(detail::find_first<false>(bitmap, 10, 1000) == 10);
+		CHECK(detail::find_last<false>(bitmap, 10, 1000) == 999);
+		CHECK_FALSE(detail::find_first<false>(bitmap, 10, 10));
+	}
+	for (const auto idx : {size_t{63}, size_t{64}, PAGE_BITS - 1, PAGE_BITS, PAGE_BITS * 2 + 5}) {
+		detail::set_bit(ez::nort, &bitmap, idx);
+	}
+	SUBCASE("set bits across word and page boundaries") {
+		CHECK(detail::find_first<true>(bitmap, 0, CAPACITY) == 63);
+		CHECK(detail::find_first<true>(bitmap, 64, CAPACITY) == 64);
+		CHECK(detail::find_first<true>(bitmap, 65, CAPACITY) == PAGE_BITS - 1);
+		CHECK(detail::find_first<true>(bitmap, PAGE_BITS, CAPACITY) == PAGE_BITS);
+		CHECK(detail::find_first<true>(bitmap, PAGE_BITS + 1, CAPACITY) == PAGE_BITS * 2 + 5);
+		CHECK_FALSE(detail::find_first<true>(bitmap, PAGE_BITS * 2 + 6, CAPACITY));
+		CHECK_FALSE(detail::find_first<true>(bitmap, 0, 63));
+		CHECK(detail::find_last<true>(bitmap, 0, CAPACITY) == PAGE_BITS * 2 + 5);
+		CHECK(detail::find_last<true>(bitmap, 0, PAGE_BITS * 2 + 5) == PAGE_BITS);
+		CHECK(detail::find_last<true>(bitmap, 0, PAGE_BITS) == PAGE_BITS - 1);
+		CHECK(detail::find_last<true>(bitmap, 0, PAGE_BITS - 1) == 64);
+		CHECK(detail::find_last<true>(bitmap, 0, 64) == 63);
+		CHECK_FALSE(detail::find_last<true>(bitmap, 0, 63));
+		CHECK(detail::find_last<true>(bitmap, 64, 65) == 64);
+		CHECK_FALSE(detail::find_last<true>(bitmap, 65, PAGE_BITS - 1));
+	}
+	SUBCASE("clear bits across word and page boundaries") {
+		for (size_t idx = 128; idx < 192; idx++) {
+			detail::set_bit(ez::nort, &bitmap, idx);
+		}
+		CHECK(detail::find_first<false>(bitmap, 63, CAPACITY) == 65);
+		CHECK(detail::find_first<false>(bitmap, 128, CAPACITY) == 192);
+		CHECK(detail::find_last<false>(bitmap, 0, 192) == 127);
+		CHECK_FALSE(detail::find_first<false>(bitmap, 128, 192));
+		CHECK(detail::find_first<false>(bitmap, PAGE_BITS - 1, CAPACITY) == PAGE_BITS + 1);
+		CHECK(detail::find_last<false>(bitmap, 0, PAGE_BITS + 1) == PAGE_BITS - 2);
+		// Pages which have never been touched, and everything past the
+		// highest bit ever set, read as clear.
+		CHECK(detail::find_first<false>(bitmap, PAGE_BITS * 3, CAPACITY) == PAGE_BITS * 3);
+		CHECK(detail::find_first<false>(bitmap, PAGE_BITS * 2 + 5, CAPACITY) == PAGE_BITS * 2 + 6);
+		CHECK(detail::find_last<false>(bitmap, 0, CAPACITY) == CAPACITY - 1);
+	}
+	SUBCASE("clear_bit") {
+		detail::clear_bit(ez::nort, &bitmap, 64);
+		detail::clear_bit(ez::nort, &bitmap, PAGE_BITS - 1);
+		CHECK(detail::find_first<true>(bitmap, 64, CAPACITY) == PAGE_BITS);
+		CHECK(detail::find_last<true>(bitmap, 0, PAGE_BITS) == 63);
+		CHECK_FALSE(detail::is_bit_set(bitmap, 64));
+		CHECK(detail::is_bit_set(bitmap, PAGE_BITS));
+	}
+	SUBCASE("past the capacity") {
+		detail::set_bit(ez::nort, &bitmap, CAPACITY);
+		CHECK_FALSE(detail::is_bit_set(bitmap, CAPACITY));
+		CHECK(detail::find_last<true>(bitmap, 0, CAPACITY * 2) == PAGE_BITS * 2 + 5);
+		CHECK(detail::find_last<false>(bitmap, 0, CAPACITY * 2) == CAPACITY - 1);
+	}
+}
+
+static auto round_trip(afs::sample_format format, float x) -> float {
+	auto bytes = std::array<std::byte, 4>{};
+	auto out   = 0.0f;
+	detail::write_samples(format, &x, 1, 1, bytes.data());
+	detail::read_samples(format, bytes.data(), detail::get_bytes_per_sample(format), 1, &out);
+	return out;
+}
+
+TEST_CASE("sample format round trips") {
+	using enum afs::sample_format;
+	SUBCASE("integer formats are exact at their own resolution") {
+		for (const auto [format, scale] : {std::pair{uint8, 128.0f}, std::pair{int16, 32768.0f}, std::pair{int24, 8388608.0f}}) {
+			for (const auto value : {-scale, -scale + 1.0f, -1.0f, 0.0f, 1.0f, scale - 1.0f}) {
+				CHECK(round_trip(format, value / scale) == value / scale);
+			}
+		}
+		CHECK(round_trip(int32, -1.0f) == -1.0f);
+		CHECK(round_trip(int32, 0.5f) == 0.5f);
+	}
+	SUBCASE("integer formats clip") {
+		CHECK(round_trip(uint8, 1.0f) == 127.0f / 128.0f);
+		CHECK(round_trip(int16, 2.0f) == 32767.0f / 32768.0f);
+		CHECK(round_trip(int16, -2.0f) == -1.0f);
+		CHECK(round_trip(int24, 1.0f) == 8388607.0f / 8388608.0f);
+	}
+	SUBCASE("uint8 silence is 0x80") {
+		auto byte = std::byte{};
+		const auto zero = 0.0f;
+		detail::write_samples(uint8, &zero, 1, 1, &byte);
+		CHECK(byte == std::byte{0x80});
+	}
+	SUBCASE("int24 is sign extended") {
+		const auto bytes = std::array{std::byte{0xFF}, std::byte{0xFF}, std::byte{0xFF}, std::byte{0x00}, std::byte{0x00}, std::byte{0x80}, std::byte{0xFF}, std::byte{0xFF}, std::byte{0x7F}};
+		auto out = std::array<float, 3>{};
+		detail::read_samples(int24, bytes.data(), 3, 3, out.data());
+		CHECK(out[0] == -1.0f / 8388608.0f);
+		CHECK(out[1] == -1.0f);
+		CHECK(out[2] == 8388607.0f / 8388608.0f);
+	}
+	SUBCASE("float16 edge values") {
+		static constexpr auto HALF_MAX      = 65504.0f;
+		static constexpr auto MIN_NORMAL    = 1.0f / 16384.0f;   // 2^-14
+		static constexpr auto MIN_SUBNORMAL = 1.0f / 16777216.0f; // 2^-24
+		for (const auto value : {0.0f, 1.0f, -1.0f, 0.5f, HALF_MAX, -HALF_MAX, MIN_NORMAL, MIN_SUBNORMAL, 3.0f * MIN_SUBNORMAL}) {
+			CHECK(round_trip(float16, value) == value);
+		}
+		CHECK(std::signbit(round_trip(float16, -0.0f)));
+		CHECK(round_trip(float16, 1.0e6f) == std::numeric_limits<float>::infinity());
+		CHECK(round_trip(float16, -1.0e6f) == -std::numeric_limits<float>::infinity());
+		CHECK(round_trip(float16, std::numeric_limits<float>::infinity()) == std::numeric_limits<float>::infinity());
+		CHECK(std::isnan(round_trip(float16, std::numeric_limits<float>::quiet_NaN())));
+		CHECK(round_trip(float16, MIN_SUBNORMAL * 0.25f) == 0.0f);
+		// Ties round to even.
+		CHECK(round_trip(float16, 1.0f + 1.0f / 2048.0f) == 1.0f);
+		CHECK(round_trip(float16, 1.0f + 3.0f / 2048.0f) == 1.0f + 1.0f / 512.0f);
+		CHECK(round_trip(float16, 0.1f) == doctest::Approx(0.1f).epsilon(1.0 / 2048.0));
+	}
+	SUBCASE("float32 is untouched") {
+		for (const auto value : {0.1f, -3.5f, 1.0e-30f, 1.0e30f}) {
+			CHECK(round_trip(float32, value) == value);
+		}
+	}
+}
+
+struct riff_chunk {
+	std::string id;
+	std::vector<uint8_t> body;
+	std::optional<uint32_t> size; // Overrides the size written in the chunk header.
+};
+
+static auto le(uint32_t x, size_t bytes) -> std::vector<uint8_t> {
+	auto out = std::vector<uint8_t>{};
+	for (size_t i = 0; i < bytes; i++) {
+		out.push_back(static_cast<uint8_t>(x >> (8 * i)));
+	}
+	return out;
+}
+
+static auto make_fmt_body(uint16_t format_tag, uint16_t channel_count, uint32_t SR, uint16_t bits_per_sample) -> std::vector<uint8_t> {
+	const auto block_align = channel_count * (bits_per_sample / 8);
+	auto out = std::vector<uint8_t>{};
+	for (const auto& field : {le(format_tag, 2), le(channel_count, 2), le(SR, 4), le(SR * block_align, 4), le(block_align, 2), le(bits_per_sample, 2)}) {
+		out.insert(out.end(), field.begin(), field.end());
+	}
+	return out;
+}
+
+static auto make_extensible_fmt_body(uint16_t sub_format, uint16_t channel_count, uint32_t SR, uint16_t bits_per_sample) -> std::vector<uint8_t> {
+	auto out = make_fmt_body(0xFFFE, channel_count, SR, bits_per_sample);
+	for (const auto& field : {le(22, 2), le(bits_per_sample, 2), le(3, 4), le(sub_format, 2)}) {
+		out.insert(out.end(), field.begin(), field.end());
+	}
+	// The rest of the KSDATAFORMAT_SUBTYPE GUID.
+	for (const auto x : {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71}) {
+		out.push_back(static_cast<uint8_t>(x));
+	}
+	return out;
+}
+
+static auto write_temp_file(const std::string& name, const std::vector<uint8_t>& bytes) -> std::filesystem::path {
+	const auto path = std::filesystem::temp_directory_path() / ("afs-test-" + name);
+	auto file = std::ofstream{path, std::ios::binary};
+	file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	return path;
+}
+
+// Writes a RIFF WAVE file to a temporary path. Odd-sized chunks are padded
+// unless pad_odd_chunks is false.
+static auto write_wav(const std::string& name, const std::vector<riff_chunk>& chunks, bool pad_odd_chunks = true) -> std::filesystem::path {
+	auto bytes = std::vector<uint8_t>{'W', 'A', 'V', 'E'};
+	for (const auto& chunk : chunks) {
+		bytes.insert(bytes.end(), chunk.id.begin(), chunk.id.end());
+		const auto size = le(chunk.size.value_or(static_cast<uint32_t>(chunk.body.size())), 4);
+		bytes.insert(bytes.end(), size.begin(), size.end());
+		bytes.insert(bytes.end(), chunk.body.begin(), chunk.body.end());
+		if (pad_odd_chunks && chunk.body.size() % 2 == 1) {
+			bytes.push_back(0);
+		}
+	}
+	auto riff = std::vector<uint8_t>{'R', 'I', 'F', 'F'};
+	const auto riff_size = le(static_cast<uint32_t>(bytes.size()), 4);
+	riff.insert(riff.end(), riff_size.begin(), riff_size.end());
+	riff.insert(riff.end(), bytes.begin(), bytes.end());
+	return write_temp_file(name + ".wav", riff);
+}
+
+static auto make_header(size_t channel_count, int SR, std::optional<uint64_t> frame_count = std::nullopt) -> audiorw::header {
+	auto out = audiorw::header{};
+	out.format        = audiorw::format::wav;
+	out.SR            = SR;
+	out.channel_count = ads::channel_count{channel_count};
+	if (frame_count) {
+		out.frame_count = ads::frame_count{*frame_count};
+	}
+	return out;
+}
+
+TEST_CASE("map_wav") {
+	// Ten stereo int16 frames.
+	auto frames = std::vector<uint8_t>{};
+	for (uint32_t i = 0; i < 20; i++) {
+		const auto sample = le(i, 2);
+		frames.insert(frames.end(), sample.begin(), sample.end());
+	}
+	const auto fmt    = riff_chunk{"fmt ", make_fmt_body(1, 2, 44100, 16)};
+	const auto header = make_header(2, 44100);
+	SUBCASE("plain") {
+		const auto path = write_wav("plain", {fmt, {"data", frames}});
+		{
+			const auto wav = detail::map_wav(ez::nort, path, header);
+			REQUIRE(wav);
+			CHECK(wav->format == afs::sample_format::int16);
+			CHECK(wav->frame_count == 10);
+			CHECK(wav->block_align == 4);
+			CHECK(std::memcmp(wav->frames, frames.data(), frames.size()) == 0);
+		}
+		std::filesystem::remove(path);
+	}
+	SUBCASE("odd-sized chunks are padded") {
+		const auto path = write_wav("odd", {{"LIST", {1, 2, 3}}, fmt, {"junk", {4}}, {"data", frames}});
+		{
+			const auto wav = detail::map_wav(ez::nort, path, header);
+			REQUIRE(wav);
+			CHECK(wav->frame_count == 10);
+			CHECK(std::memcmp(wav->frames, frames.data(), frames.size()) == 0);
+		}
+		std::filesystem::remove(path);
+	}
+	SUBCASE("odd-sized data chunk") {
+		auto odd_frames = frames;
+		odd_frames.push_back(0xAB);
+		const auto path = write_wav("odd-data", {fmt, {"data", odd_frames}});
+		{
+			const auto wav = detail::map_wav(ez::nort, path, header);
+			REQUIRE(wav);
+			CHECK(wav->frame_count == 10);
+		}
+		std::filesystem::remove(path);
+	}
+	SUBCASE("truncated data chunk") {
+		const auto path = write_wav("truncated", {fmt, {"data", frames, uint32_t{4000}}});
+		{
+			const auto wav = detail::map_wav(ez::nort, path, header);
+			REQUIRE(wav);
+			CHECK(wav->frame_count == 10);
+		}
+		std::filesystem::remove(path);
+	}
+	SUBCASE("truncated before the data chunk") {
+		const auto path = write_wav("truncated-early", {fmt, {"LIST", {1, 2, 3, 4}, uint32_t{4000}}, {"data", frames}});
+		CHECK_FALSE(detail::map_wav(ez::nort, path, header));
+		std::filesystem::remove(path);
+	}
+	SUBCASE("WAVE_FORMAT_EXTENSIBLE") {
+		auto float_frames = std::vector<uint8_t>(10 * 2 * 4);
+		const auto float_path = write_wav("extensible-float", {{"fmt ", make_extensible_fmt_body(3, 2, 44100, 32)}, {"data", float_frames}});
+		const auto int24_path = write_wav("extensible-int24", {{"fmt ", make_extensible_fmt_body(1, 2, 44100, 24)}, {"data", std::vector<uint8_t>(10 * 2 * 3)}});
+		{
+			const auto float_wav = detail::map_wav(ez::nort, float_path, header);
+			const auto int24_wav = detail::map_wav(ez::nort, int24_path, header);
+			REQUIRE(float_wav);
+			REQUIRE(int24_wav);
+			CHECK(float_wav->format == afs::sample_format::float32);
+			CHECK(int24_wav->format == afs::sample_format::int24);
+			CHECK(float_wav->frame_count == 10);
+			CHECK(int24_wav->frame_count == 10);
+		}
+		std::filesystem::remove(float_path);
+		std::filesystem::remove(int24_path);
+	}
+	SUBCASE("rejected") {
+		const auto path          = write_wav("plain", {fmt, {"data", frames}});
+		const auto no_fmt_path   = write_wav("no-fmt", {{"data", frames}});
+		const auto adpcm_path    = write_wav("adpcm", {{"fmt ", make_fmt_body(2, 2, 44100, 16)}, {"data", frames}});
+		const auto unpadded_path = write_wav("unpadded", {{"LIST", {1, 2, 3}}, fmt, {"data", frames}}, false);
+		CHECK_FALSE(detail::map_wav(ez::nort, path, make_header(1, 44100)));
+		CHECK_FALSE(detail::map_wav(ez::nort, path, make_header(2, 48000)));
+		CHECK_FALSE(detail::map_wav(ez::nort, path, make_header(2, 44100, 11)));
+		CHECK(detail::map_wav(ez::nort, path, make_header(2, 44100, 10)));
+		CHECK_FALSE(detail::map_wav(ez::nort, no_fmt_path, header));
+		CHECK_FALSE(detail::map_wav(ez::nort, adpcm_path, header));
+		CHECK_FALSE(detail::map_wav(ez::nort, unpadded_path, header));
+		for (const auto& x : {path, no_fmt_path, adpcm_path, unpadded_path}) {
+			std::filesystem::remove(x);
+		}
+	}
+}
+
+// An MPEG 1 layer III frame at 128kbps, 44.1kHz, stereo. Each one is 417
+// bytes and decodes to 1152 frames.
+static auto make_mp3_frame() -> std::vector<uint8_t> {
+	auto out = std::vector<uint8_t>(417);
+	out[0] = 0xFF;
+	out[1] = 0xFB;
+	out[2] = 0x90;
+	return out;
+}
+
+static auto put(std::vector<uint8_t>* out, size_t pos, const std::vector<uint8_t>& bytes) -> void {
+	std::copy(bytes.begin(), bytes.end(), out->begin() + static_cast<ptrdiff_t>(pos));
+}
+
+static auto be(uint32_t x) -> std::vector<uint8_t> {
+	return {static_cast<uint8_t>(x >> 24), static_cast<uint8_t>(x >> 16), static_cast<uint8_t>(x >> 8), static_cast<uint8_t>(x)};
+}
+
+static auto scan_mp3(const std::string& name, const std::vector<std::vector<uint8_t>>& parts, auto should_stop) -> std::optional<ads::frame_count> {
+	auto bytes = std::vector<uint8_t>{};
+	for (const auto& part : parts) {
+		bytes.insert(bytes.end(), part.begin(), part.end());
+	}
+	const auto path = write_temp_file(name + ".mp3", bytes);
+	auto out = std::optional<ads::frame_count>{};
+	if (const auto file = detail::map_file(ez::nort, path)) {
+		out = detail::scan_mp3_frame_count(ez::nort, *file, should_stop);
+	}
+	std::filesystem::remove(path);
+	return out;
+}
+
+static auto scan_mp3(const std::string& name, const std::vector<std::vector<uint8_t>>& parts) -> std::optional<ads::frame_count> {
+	return scan_mp3(name, parts, [] { return false; });
+}
+
+TEST_CASE("MP3 length scan") {
+	static constexpr auto XING = size_t{4 + 32};
+	static constexpr auto VBRI = size_t{4 + 32};
+	const auto frame = make_mp3_frame();
+	SUBCASE("walks the frame headers") {
+		CHECK(scan_mp3("walk", {frame, frame, frame}) == ads::frame_count{3 * 1152});
+	}
+	SUBCASE("skips ID3 tags") {
+		auto id3v2 = std::vector<uint8_t>{'I', 'D', '3', 4, 0, 0, 0, 0, 0, 20};
+		id3v2.resize(30, 0xFF);
+		auto id3v1 = std::vector<uint8_t>{'T', 'A', 'G'};
+		id3v1.resize(128, 0xFF);
+		CHECK(scan_mp3("id3", {id3v2, frame, frame, id3v1}) == ads::frame_count{2 * 1152});
+	}
+	SUBCASE("resynchronises after junk between frames") {
+		const auto junk = std::vector<uint8_t>{1, 2, 3, 0xFF, 0xFB, 7, 8};
+		CHECK(scan_mp3("junk", {frame, frame, junk, frame, frame}) == ads::frame_count{4 * 1152});
+	}
+	SUBCASE("reads the frame count from a Xing header") {
+		auto xing = frame;
+		put(&xing, XING, {'X', 'i', 'n', 'g'});
+		put(&xing, XING + 4, be(1));
+		put(&xing, XING + 8, be(1000));
+		CHECK(scan_mp3("xing", {xing, frame, frame}) == ads::frame_count{1000 * 1152});
+		put(&xing, XING, {'I', 'n', 'f', 'o'});
+		CHECK(scan_mp3("info", {xing, frame, frame}) == ads::frame_count{1000 * 1152});
+	}
+	SUBCASE("takes off the encoder delay and padding in a LAME tag") {
+		auto xing = frame;
+		put(&xing, XING, {'X', 'i', 'n', 'g'});
+		put(&xing, XING + 4, be(1));
+		put(&xing, XING + 8, be(1000));
+		// 576 frames of delay and 1000 of padding, twelve bits each.
+		put(&xing, XING + 12, {'L', 'A', 'M', 'E'});
+		put(&xing, XING + 12 + 21, {0x24, 0x03, 0xE8});
+		CHECK(scan_mp3("lame", {xing, frame, frame}) == ads::frame_count{1000 * 1152 - 576 - 1000});
+	}
+	SUBCASE("walks the frames after a Xing header without a frame count") {
+		auto xing = frame;
+		put(&xing, XING, {'X', 'i', 'n', 'g'});
+		put(&xing, XING + 4, be(0));
+		CHECK(scan_mp3("xing-no-count", {xing, frame, frame, frame}) == ads::frame_count{3 * 1152});
+	}
+	SUBCASE("reads the frame count from a VBRI header") {
+		auto vbri = frame;
+		put(&vbri, VBRI, {'V', 'B', 'R', 'I'});
+		put(&vbri, VBRI + 14, be(500));
+		CHECK(scan_mp3("vbri", {vbri, frame}) == ads::frame_count{500 * 1152});
+	}
+	SUBCASE("gives up") {
+		CHECK_FALSE(scan_mp3("not-mp3", {std::vector<uint8_t>(2000, 0x55)}));
+		auto frames = std::vector<std::vector<uint8_t>>(5000, frame);
+		CHECK_FALSE(scan_mp3("stopped", frames, [] { return true; }));
+	}
+}
+
+static auto append_raw(std::vector<uint8_t>* out, const auto& x) -> void {
+	const auto bytes = reinterpret_cast<const uint8_t*>(&x);
+	out->insert(out->end(), bytes, bytes + sizeof(x));
+}
+
+static auto read_disk_cache_file(const std::string& name, const std::vector<uint8_t>& bytes, const std::string& identity, size_t chunk_size) -> afs::uptr<detail::disk_cache_file> {
+	const auto path = write_temp_file(name + ".afspcm", bytes);
+	auto file = afs::make_uptr<detail::disk_cache_file>();
+	file->channel_count = 2;
+	file->format        = afs::sample_format::float32;
+	file->mapping       = detail::map_file(ez::nort, path);
+	const auto ok = file->mapping && detail::read_disk_cache_records(ez::nort, file.get(), identity, chunk_size);
+	file->mapping.reset();
+	std::filesystem::remove(path);
+	if (!ok) {
+		return nullptr;
+	}
+	return file;
+}
+
+TEST_CASE("disk cache records") {
+	static constexpr auto CHUNK_SIZE = size_t{64};
+	const auto identity = std::string{"test.flac"};
+	auto header = detail::disk_cache_header{};
+	header.magic         = detail::DISK_CACHE_MAGIC;
+	header.chunk_size    = CHUNK_SIZE;
+	header.channel_count = 2;
+	header.format        = static_cast<uint32_t>(afs::sample_format::float32);
+	header.identity_size = identity.size();
+	const auto records = std::vector<detail::disk_cache_record_header>{
+		{0, CHUNK_SIZE, CHUNK_SIZE * 2 * 4},
+		{1, CHUNK_SIZE, 0}, // Silent.
+		{2, 10, 10 * 2 * 4},
+	};
+	const auto make_file = [&](const detail::disk_cache_header& header, const std::vector<detail::disk_cache_record_header>& records, std::vector<size_t>* ends) {
+		auto out = std::vector<uint8_t>{};
+		append_raw(&out, header);
+		out.insert(out.end(), identity.begin(), identity.end());
+		if (ends) { ends->push_back(out.size()); }
+		for (const auto& record : records) {
+			append_raw(&out, record);
+			out.resize(out.size() + record.byte_count, static_cast<uint8_t>(record.chunk_idx + 1));
+			if (ends) { ends->push_back(out.size()); }
+		}
+		return out;
+	};
+	auto record_ends = std::vector<size_t>{};
+	const auto bytes = make_file(header, records, &record_ends);
+	SUBCASE("intact") {
+		const auto file = read_disk_cache_file("intact", bytes, identity, CHUNK_SIZE);
+		REQUIRE(file);
+		REQUIRE(file->records.size() == 3);
+		CHECK(file->records.at(0).offset == record_ends[0] + sizeof(detail::disk_cache_record_header));
+		CHECK(file->records.at(0).byte_count == CHUNK_SIZE * 2 * 4);
+		CHECK(file->records.at(1).byte_count == 0);
+		CHECK(file->records.at(2).frame_count == ads::frame_count{10});
+		CHECK(file->written.size() == 3);
+	}
+	SUBCASE("truncated") {
+		// A write can be interrupted anywhere. Only files which end between
+		// records are any good.
+		for (size_t size = 1; size < bytes.size(); size++) {
+			const auto truncated = std::vector<uint8_t>(bytes.begin(), bytes.begin() + static_cast<ptrdiff_t>(size));
+			const auto file      = read_disk_cache_file("truncated", truncated, identity, CHUNK_SIZE);
+			const auto boundary  = std::find(record_ends.begin(), record_ends.end(), size);
+			CHECK_MESSAGE((file != nullptr) == (boundary != record_ends.end()), "size ", size);
+			if (file && boundary != record_ends.end()) {
+				CHECK(file->records.size() == static_cast<size_t>(boundary - record_ends.begin()));
+			}
+		}
+	}
+	SUBCASE("corrupt") {
+		auto bad_magic = header;
+		bad_magic.magic[7] = 'x';
+		CHECK_FALSE(read_disk_cache_file("bad-magic", make_file(bad_magic, records, nullptr), identity, CHUNK_SIZE));
+		auto bad_format = header;
+		bad_format.format = static_cast<uint32_t>(afs::sample_format::int16);
+		CHECK_FALSE(read_disk_cache_file("bad-format", make_file(bad_format, records, nullptr), identity, CHUNK_SIZE));
+		CHECK_FALSE(read_disk_cache_file("other-chunk-size", bytes, identity, CHUNK_SIZE * 2));
+		CHECK_FALSE(read_disk_cache_file("other-identity", bytes, "test.ogg!", CHUNK_SIZE));
+		CHECK_FALSE(read_disk_cache_file("short-identity", bytes, "test", CHUNK_SIZE));
+		auto too_many_frames = records;
+		too_many_frames[1].frame_count = CHUNK_SIZE + 1;
+		CHECK_FALSE(read_disk_cache_file("too-many-frames", make_file(header, too_many_frames, nullptr), identity, CHUNK_SIZE));
+		auto wrong_byte_count = records;
+		wrong_byte_count[2].byte_count = 12 * 2 * 4;
+		CHECK_FALSE(read_disk_cache_file("wrong-byte-count", make_file(header, wrong_byte_count, nullptr), identity, CHUNK_SIZE));
+		// Says it is bigger than the rest of the file.
+		auto overrun = make_file(header, records, nullptr);
+		auto record  = records[2];
+		record.byte_count = 1 << 20;
+		std::memcpy(overrun.data() + record_ends[2], &record, sizeof(record));
+		CHECK_FALSE(read_disk_cache_file("overrun", overrun, identity, CHUNK_SIZE));
+	}
+}
+
+TEST_CASE("chunk pool recycles chunks") {
+	auto pool = afs::chunk_pool{ez::nort, size_t{1} << 20};
+	const auto impl = pool.get_impl(ez::nort);
+	auto chunk = detail::make_chunk_data(ez::nort, impl, afs::sample_format::float32, ads::channel_count{2}, 100);
+	const auto object = chunk.get();
+	const auto bytes  = chunk->bytes.data();
+	CHECK(chunk->bytes.size() == 100 * 2 * 4);
+	chunk.reset();
+	CHECK(impl->buffers.at(100 * 2 * 4).size() == 1);
+	CHECK(impl->blocks.size() == 1);
+	// The same block and bytes come back, so nothing was allocated.
+	chunk = detail::make_chunk_data(ez::nort, impl, afs::sample_format::float32, ads::channel_count{2}, 100);
+	CHECK(chunk.get() == object);
+	CHECK(chunk->bytes.data() == bytes);
+	CHECK(impl->buffers.at(100 * 2 * 4).empty());
+	CHECK(impl->bytes == 0);
+	// Chunks keep the pool alive.
+	auto other = detail::make_chunk_data(ez::nort, impl, afs::sample_format::int16, ads::channel_count{1}, 10);
+	{ auto dropped = std::move(pool); }
+	chunk.reset();
+	other.reset();
+}
+
+TEST_CASE("silent chunks aren't evicted") {
+	auto shared = detail::shared_safe{};
+	auto state  = detail::loader_state{};
+	const auto chunk = detail::make_chunk_data(ez::nort, nullptr, afs::sample_format::float32, ads::channel_count{1}, 16);
+	// Silent chunks at both ends, with chunks holding bytes inside them.
+	state.chunks = {detail::get_silent_chunk(), chunk, chunk, chunk, detail::get_silent_chunk(), detail::get_silent_chunk()};
+	for (size_t i = 0; i < state.chunks.size(); i++) {
+		detail::set_bit(ez::nort, &shared.loaded, i);
+	}
+	shared.chunks.chunk_size = 16;
+	shared.atomics.reported_playback_pos.store(16.0);
+	CHECK(detail::find_chunk_to_evict(shared, state) == 3);
+	state.chunks[3] = detail::get_silent_chunk();
+	CHECK(detail::find_chunk_to_evict(shared, state) == 2);
+	state.chunks[1] = detail::get_silent_chunk();
+	state.chunks[2] = detail::get_silent_chunk();
+	CHECK_FALSE(detail::find_chunk_to_evict(shared, state));
+	state.approximate_chunks = {4, 5};
+	CHECK_FALSE(detail::find_approximate_chunk_to_evict(state, 1));
+}
+
+// Stands in for a thread when a test drives the loader itself.
+struct no_thread {
+	no_thread() = default;
+	no_thread(auto&&...) {}
+};
+
+template <typename Stream>
+static auto make_test_impl(Stream stream, detail::loader_options options) -> afs::uptr<detail::impl<Stream, no_thread>> {
+	auto x = afs::make_uptr<detail::impl<Stream, no_thread>>();
+	detail::init<Stream, no_thread, std::stop_token>(ez::nort, x.get(), std::move(stream), std::move(options));
+	return x;
+}
+
+// Every frame of the mock streams says where it came from, and none of them
+// are silent.
+static auto mock_sample(size_t frame, size_t ch) -> float {
+	const auto x = static_cast<float>(frame % 1000 + 1) / 1024.0f;
+	return ch == 0 ? x : -x;
+}
+
+struct mock_stream_log {
+	size_t seeks    = 0;
+	size_t seek_tos = 0;
+	std::function<void()> on_read;
+};
+
+// A stream of mock_sample()s which counts as BYTES_PER_FRAME bytes per
+// frame read. Frames [silent_beg, silent_end) are silent.
+struct mock_stream {
+	static constexpr auto BYTES_PER_FRAME = size_t{4};
+	audiorw::header header;
+	size_t frame_count = 0;
+	size_t pos         = 0;
+	size_t silent_beg  = 0;
+	size_t silent_end  = 0;
+	afs::shptr<mock_stream_log> log = afs::make_shptr<mock_stream_log>();
+	auto get_header() -> audiorw::header { return header; }
+	auto read_frames(std::span<float> out) -> ads::frame_count {
+		if (log->on_read) { log->on_read(); }
+		const auto channel_count = header.channel_count.value;
+		const auto frames        = std::min(out.size() / channel_count, frame_count - std::min(pos, frame_count));
+		for (size_t i = 0; i < frames; i++) {
+			for (size_t ch = 0; ch < channel_count; ch++) {
+				const auto silent = silent_beg <= pos + i && pos + i < silent_end;
+				out[i * channel_count + ch] = silent ? 0.0f : mock_sample(pos + i, ch);
+			}
+		}
+		pos += frames;
+		return ads::frame_count{frames};
+	}
+	auto seek(ads::frame_idx frame) -> void { pos = static_cast<size_t>(frame.value); log->seeks++; }
+	auto get_total_bytes_read() -> size_t { return pos * BYTES_PER_FRAME; }
+};
+
+// Models an MP3 decoder: it can only resume from a seek point, which is
+// PRIMING frames before the frame it will read next.
+struct mock_seek_point_stream : mock_stream {
+	static constexpr auto PRIMING = size_t{100};
+	auto get_seek_point() -> afs::stream_seek_point {
+		const auto frame = pos > PRIMING ? pos - PRIMING : size_t{0};
+		return {frame * BYTES_PER_FRAME, ads::frame_idx{static_cast<int64_t>(frame)}};
+	}
+	auto seek_to(afs::stream_seek_point point) -> void { pos = point.byte_offset / BYTES_PER_FRAME; log->seek_tos++; }
+};
+
+template <typename Stream>
+static auto make_mock_mp3(size_t channel_count, size_t frame_count, bool length_known) -> Stream {
+	auto out = Stream{};
+	out.header               = make_header(channel_count, 44100, length_known ? std::optional<uint64_t>{frame_count} : std::nullopt);
+	out.header.format        = audiorw::format::mp3;
+	out.header.stream_length = frame_count * mock_stream::BYTES_PER_FRAME;
+	out.frame_count          = frame_count;
+	return out;
+}
+
+// Checks that chunk_idx holds the frames the stream has at that position.
+static auto is_chunk_correct(const detail::chunk_data& chunk, size_t chunk_size, size_t chunk_idx, size_t channel_count) -> bool {
+	for (size_t ch = 0; ch < channel_count; ch++) {
+		const auto data = reinterpret_cast<const float*>(detail::get_channel_data(chunk, ads::channel_idx{ch}));
+		for (size_t i = 0; i < chunk.frame_count; i++) {
+			if (data[i] != mock_sample(chunk_idx * chunk_size + i, ch)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+TEST_CASE("streams of unknown length") {
+	static constexpr auto CHUNK_SIZE  = size_t{16384};
+	static constexpr auto FRAME_COUNT = size_t{40000};
+	static constexpr auto BLOCK       = size_t{256};
+	auto stream = make_mock_mp3<mock_stream>(2, FRAME_COUNT, false);
+	auto log    = stream.log;
+	auto x      = make_test_impl(std::move(stream), {.chunk_size = CHUNK_SIZE});
+	auto left   = std::vector<float>(BLOCK);
+	auto right  = std::vector<float>(BLOCK);
+	auto played = size_t{0};
+	// The audio thread gets a turn before every read, including the ones
+	// between a chunk being published and the chunk being finished.
+	const auto play = [&] {
+		const auto pos = x->servo.playback_pos;
+		detail::process(ez::audio, x.get(), 44100.0, {left.data(), right.data()}, BLOCK);
+		REQUIRE(x->servo.state == detail::state::playing);
+		for (size_t i = 0; i < static_cast<size_t>(x->servo.playback_pos - pos); i++) {
+			REQUIRE(left[i] == mock_sample(static_cast<size_t>(pos) + i, 0));
+			REQUIRE(right[i] == mock_sample(static_cast<size_t>(pos) + i, 1));
+		}
+		played += static_cast<size_t>(x->servo.playback_pos - pos);
+	};
+	log->on_read = [&] {
+		if (detail::find_chunk(ez::audio, x->shared.chunks, 0)) {
+			CHECK(x->shared.published.estimated_frame_count.load() > 0);
+		}
+		play();
+	};
+	while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+	log->on_read = nullptr;
+	CHECK(played > 0);
+	CHECK(x->shared.model.read(ez::nort).header.frame_count == ads::frame_count{FRAME_COUNT});
+	// Now the length is known, playback stops at the end.
+	while (x->servo.state == detail::state::playing) {
+		detail::process(ez::audio, x.get(), 44100.0, {left.data(), right.data()}, BLOCK);
+		REQUIRE(x->servo.playback_pos <= static_cast<double>(FRAME_COUNT + BLOCK));
+	}
+	CHECK(x->shared.atomics.reported_finished.load());
+	for (size_t i = 0; i < 3; i++) {
+		CHECK(is_chunk_correct(*x->loader.state.chunks[i], CHUNK_SIZE, i, 2));
+	}
+}
+
+TEST_CASE("seek index") {
+	static constexpr auto CHUNK_SIZE  = size_t{8192};
+	static constexpr auto FRAME_COUNT = CHUNK_SIZE * 5 + 1000;
+	auto stream = make_mock_mp3<mock_seek_point_stream>(2, FRAME_COUNT, true);
+	auto log    = stream.log;
+	auto x      = make_test_impl(std::move(stream), {.chunk_size = CHUNK_SIZE});
+	auto& state = x->loader.state;
+	REQUIRE(state.seek_index.size() == 1);
+	while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+	// Read straight through, so nothing was sought.
+	CHECK(log->seeks == 0);
+	CHECK(log->seek_tos == 0);
+	// One seek point per chunk, except after the last one.
+	REQUIRE(state.seek_index.size() == 6);
+	CHECK(state.seek_index[0].frame.value == 0);
+	for (size_t i = 1; i < state.seek_index.size(); i++) {
+		CHECK(state.seek_index[i].frame.value == static_cast<int64_t>(i * CHUNK_SIZE - mock_seek_point_stream::PRIMING));
+		CHECK(state.seek_index[i].byte_offset == (i * CHUNK_SIZE - mock_seek_point_stream::PRIMING) * mock_stream::BYTES_PER_FRAME);
+	}
+	for (size_t i = 0; i < 6; i++) {
+		CHECK(is_chunk_correct(*state.chunks[i], CHUNK_SIZE, i, 2));
+	}
+	SUBCASE("indexed seeks land on the right chunk") {
+		const auto sequential_1 = state.chunks[1];
+		const auto sequential_3 = state.chunks[3];
+		detail::evict_chunk(ez::nort, &state, &x->shared, 1);
+		detail::evict_chunk(ez::nort, &state, &x->shared, 3);
+		x->shared.atomics.reported_playback_pos.store(static_cast<double>(3 * CHUNK_SIZE + 10));
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(log->seek_tos == 1);
+		CHECK(state.stream_pos == ads::frame_idx{static_cast<int64_t>(4 * CHUNK_SIZE)});
+		REQUIRE(state.chunks[3]);
+		CHECK(is_chunk_correct(*state.chunks[3], CHUNK_SIZE, 3, 2));
+		// The frames thrown away to prime the decoder don't shift anything.
+		CHECK(std::ranges::equal(state.chunks[3]->bytes, sequential_3->bytes));
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(log->seek_tos == 2);
+		REQUIRE(state.chunks[1]);
+		CHECK(std::ranges::equal(state.chunks[1]->bytes, sequential_1->bytes));
+		CHECK(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::finished);
+		CHECK(log->seeks == 0);
+	}
+	SUBCASE("the chunk after the last one loaded needs no seek") {
+		detail::evict_chunk(ez::nort, &state, &x->shared, 4);
+		detail::evict_chunk(ez::nort, &state, &x->shared, 5);
+		x->shared.atomics.reported_playback_pos.store(static_cast<double>(4 * CHUNK_SIZE));
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(log->seek_tos == 1);
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(log->seek_tos == 1);
+		CHECK(is_chunk_correct(*state.chunks[4], CHUNK_SIZE, 4, 2));
+		CHECK(is_chunk_correct(*state.chunks[5], CHUNK_SIZE, 5, 2));
+	}
+}
+
+TEST_CASE("approximate jumps") {
+	static constexpr auto CHUNK_SIZE  = size_t{4096};
+	static constexpr auto FRAME_COUNT = CHUNK_SIZE * 40 + 500;
+	static constexpr auto FAR_CHUNK   = size_t{30};
+	auto stream = make_mock_mp3<mock_seek_point_stream>(2, FRAME_COUNT, false);
+	auto log    = stream.log;
+	auto x      = make_test_impl(std::move(stream), {.chunk_size = CHUNK_SIZE});
+	auto& state = x->loader.state;
+	const auto chunk_beg = [](size_t chunk_idx) { return ads::frame_idx{static_cast<int64_t>(chunk_idx * CHUNK_SIZE)}; };
+	// The first chunk gives the loader an estimate to jump with.
+	REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+	REQUIRE(state.seek_index.size() == 2);
+	REQUIRE(x->shared.model.read(ez::nort).estimated_frame_count == ads::frame_count{FRAME_COUNT});
+	// Too far past the end of the seek index to decode there in time.
+	x->shared.atomics.reported_playback_pos.store(static_cast<double>(FAR_CHUNK * CHUNK_SIZE + 10));
+	REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+	CHECK(log->seek_tos == 1);
+	CHECK(log->seeks == 0);
+	CHECK(state.approximate_chunks == std::vector{FAR_CHUNK});
+	CHECK(state.stream_pos == chunk_beg(FAR_CHUNK + 1));
+	CHECK(state.stream_approximate);
+	CHECK(detail::find_chunk(ez::audio, x->shared.chunks, FAR_CHUNK) == state.chunks[FAR_CHUNK].get());
+	CHECK_FALSE(detail::is_bit_set(x->shared.loaded, FAR_CHUNK));
+	// The mock's bytes per frame never change, so the jump is exact.
+	CHECK(is_chunk_correct(*state.chunks[FAR_CHUNK], CHUNK_SIZE, FAR_CHUNK, 2));
+	// The chunks after it follow straight on.
+	for (size_t i = 1; i < detail::APPROXIMATE_SEEK_LOOKAHEAD; i++) {
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(state.approximate_chunks.size() == i + 1);
+		CHECK(state.stream_pos == chunk_beg(FAR_CHUNK + i + 1));
+		CHECK(is_chunk_correct(*state.chunks[FAR_CHUNK + i], CHUNK_SIZE, FAR_CHUNK + i, 2));
+	}
+	CHECK(log->seek_tos == 1);
+	// Back to the end of the seek index, with a real seek point.
+	REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+	CHECK(log->seek_tos == 2);
+	CHECK(state.stream_pos == chunk_beg(2));
+	CHECK_FALSE(state.stream_approximate);
+	CHECK(detail::is_bit_set(x->shared.loaded, 1));
+	CHECK(is_chunk_correct(*state.chunks[1], CHUNK_SIZE, 1, 2));
+	CHECK(state.approximate_chunks.size() == detail::APPROXIMATE_SEEK_LOOKAHEAD);
+	// The approximate chunks are replaced as the seek index reaches them,
+	// without another seek.
+	while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+	CHECK(log->seek_tos == 2);
+	CHECK(state.approximate_chunks.empty());
+	// There's no limit, so nothing was reserved and nothing was released.
+	CHECK(state.usage.bytes == 0);
+	CHECK(x->shared.model.read(ez::nort).header.frame_count == ads::frame_count{FRAME_COUNT});
+	REQUIRE(state.chunks.size() == 41);
+	for (size_t i = 0; i < state.chunks.size(); i++) {
+		CHECK(detail::is_bit_set(x->shared.loaded, i));
+		CHECK(detail::find_chunk(ez::audio, x->shared.chunks, i) == state.chunks[i].get());
+		CHECK(is_chunk_correct(*state.chunks[i], CHUNK_SIZE, i, 2));
+	}
+}
+
+// The scalar code and whichever instruction sets this machine has.
+static auto get_supported_isas() -> std::vector<detail::isa> {
+	auto out = std::vector{detail::isa::scalar};
+	if (detail::get_isa() != detail::isa::scalar) { out.push_back(detail::isa::sse); }
+	if (detail::get_isa() == detail::isa::avx2)   { out.push_back(detail::isa::avx2); }
+	return out;
+}
+
+static auto make_random_samples(size_t count, float range) -> std::vector<float> {
+	auto rng  = std::mt19937{1234};
+	auto dist = std::uniform_real_distribution<float>{-range, range};
+	auto out  = std::vector<float>(count);
+	for (auto& x : out) {
+		x = dist(rng);
+	}
+	return out;
+}
+
+#if AFS_X86
+static auto resample_sinc(detail::isa isa, const detail::sinc_table& table, const float* in, double pos, double frame_inc, size_t frame_count, float* out) -> void {
+	switch (isa) {
+		case detail::isa::avx2: { return detail::resample_sinc_avx2(table, in, pos, frame_inc, frame_count, out); }
+		case detail::isa::sse:  { return detail::resample_sinc_sse(table, in, pos, frame_inc, frame_count, out); }
+		default:                { return detail::resample_sinc_scalar(table, in, pos, frame_inc, frame_count, out); }
+	}
+}
+#endif
+
+TEST_CASE("SIMD kernels match the scalar code") {
+	SUBCASE("deinterleave") {
+		// One frame short so that the kernels leave a tail to the scalar code.
+		static constexpr auto FRAME_COUNT = size_t{4095};
+		for (const auto format : {afs::sample_format::float32, afs::sample_format::int16}) {
+			for (const auto channel_count : {size_t{1}, size_t{2}, size_t{3}, size_t{4}, size_t{6}, size_t{8}}) {
+				// Out of range too, so that clipping is covered.
+				const auto in       = make_random_samples(FRAME_COUNT * channel_count, 1.1f);
+				const auto stride   = (FRAME_COUNT + 1) * detail::get_bytes_per_sample(format);
+				auto expected       = std::vector<std::byte>(stride * channel_count);
+				detail::deinterleave_samples(detail::isa::scalar, format, in.data(), ads::channel_count{channel_count}, FRAME_COUNT, expected.data(), stride);
+				for (const auto isa : get_supported_isas()) {
+					INFO("format " << static_cast<int>(format) << ", " << channel_count << " channels, isa " << static_cast<int>(isa));
+					auto out = std::vector<std::byte>(stride * channel_count);
+					detail::deinterleave_samples(isa, format, in.data(), ads::channel_count{channel_count}, FRAME_COUNT, out.data(), stride);
+					CHECK(out == expected);
+				}
+			}
+		}
+	}
+#if AFS_X86
+	SUBCASE("sinc") {
+		static constexpr auto FRAME_COUNT = size_t{1000};
+		static constexpr auto REACH       = detail::sinc_table::TAPS;
+		const auto in = make_random_samples(4096, 1.0f);
+		const auto& bank = detail::get_sinc_bank();
+		for (size_t t = 0; t < bank.tables.size(); t++) {
+			for (const auto frame_inc : {0.5, 0.9173, 1.0, 1.3, 2.0, 3.61}) {
+				const auto pos = REACH + 0.37;
+				auto expected  = std::vector<float>(FRAME_COUNT);
+				resample_sinc(detail::isa::scalar, bank.tables[t], in.data(), pos, frame_inc, FRAME_COUNT, expected.data());
+				for (const auto isa : get_supported_isas()) {
+					INFO("table " << t << ", frame_inc " << frame_inc << ", isa " << static_cast<int>(isa));
+					auto out = std::vector<float>(FRAME_COUNT);
+					resample_sinc(isa, bank.tables[t], in.data(), pos, frame_inc, FRAME_COUNT, out.data());
+					// The sums are done in a different order, so only close.
+					auto max_error = 0.0f;
+					for (size_t i = 0; i < FRAME_COUNT; i++) {
+						max_error = std::max(max_error, std::abs(out[i] - expected[i]));
+					}
+					CHECK(max_error < 1.0e-5f);
+				}
+			}
+		}
+	}
+#endif
+}
+
+// A mono float32 WAV mapping of frames [GUARD, GUARD + frame_count) of
+// memory, with junk on either side which should never be read.
+struct test_wav {
+	static constexpr auto GUARD = size_t{64};
+	static constexpr auto JUNK  = 1.0e6f;
+	std::vector<float> memory;
+	detail::mapped_wav wav;
+	detail::snapshot snapshot;
+	test_wav(std::vector<float> frames) : memory(frames.size() + 2 * GUARD, JUNK) {
+		std::ranges::copy(frames, memory.begin() + GUARD);
+		wav.frames           = reinterpret_cast<const std::byte*>(memory.data() + GUARD);
+		wav.format           = afs::sample_format::float32;
+		wav.bytes_per_sample = sizeof(float);
+		wav.block_align      = sizeof(float);
+		wav.frame_count      = frames.size();
+		snapshot.channel_count         = ads::channel_count{1};
+		snapshot.SR                    = 44100.0;
+		snapshot.estimated_frame_count = ads::frame_count{frames.size()};
+		snapshot.frame_count_known     = true;
+	}
+};
+
+// Resamples with sinc interpolation into an output buffer and a scratch
+// buffer which both have canaries past their ends.
+static auto resample_sinc(const test_wav& src, double pos, double frame_inc, size_t frame_count) -> std::vector<float> {
+	static constexpr auto CANARY = -7.0f;
+	static constexpr auto GUARD  = size_t{64};
+	auto resampler = detail::resampler{};
+	resampler.buffer.resize(detail::resampler::SCRATCH_SIZE + GUARD, CANARY);
+	auto out = std::vector<float>(frame_count + 2 * GUARD, CANARY);
+	detail::resample(ez::audio, src.wav, src.snapshot, &resampler, afs::interpolation::sinc, ads::channel_idx{0}, pos, frame_inc, frame_count, out.data() + GUARD);
+	CHECK(std::all_of(resampler.buffer.begin() + detail::resampler::SCRATCH_SIZE, resampler.buffer.end(), [](float x) { return x == CANARY; }));
+	CHECK(std::all_of(out.begin(), out.begin() + GUARD, [](float x) { return x == CANARY; }));
+	CHECK(std::all_of(out.end() - GUARD, out.end(), [](float x) { return x == CANARY; }));
+	return {out.begin() + GUARD, out.end() - GUARD};
+}
+
+TEST_CASE("sinc resampler") {
+	static constexpr auto FRAME_COUNT = size_t{20000};
+	static constexpr auto TAPS        = detail::sinc_table::TAPS;
+	// Upsampling, and downsampling with each of the lowered cutoffs.
+	static constexpr auto FRAME_INCS  = std::array{0.73, 1.13, 1.37, 1.81, 2.6, 3.3};
+	const auto max_error = [](const std::vector<float>& out, auto expected) {
+		auto error = 0.0;
+		for (size_t i = 0; i < out.size(); i++) {
+			error = std::max(error, std::abs(static_cast<double>(out[i]) - expected(i)));
+		}
+		return error;
+	};
+	SUBCASE("DC gain is 1") {
+		const auto src = test_wav{std::vector<float>(FRAME_COUNT, 0.5f)};
+		for (const auto frame_inc : FRAME_INCS) {
+			INFO("frame_inc " << frame_inc);
+			const auto out = resample_sinc(src, 100.25, frame_inc, 5000);
+			CHECK(max_error(out, [](size_t) { return 0.5; }) < 1.0e-5);
+		}
+	}
+	SUBCASE("in-band sine") {
+		static constexpr auto FREQ = 0.02; // Cycles per frame, in band at every rate.
+		const auto sine = [](double frame) { return 0.5 * std::sin(2.0 * std::numbers::pi * FREQ * frame); };
+		auto frames = std::vector<float>(FRAME_COUNT);
+		for (size_t i = 0; i < FRAME_COUNT; i++) {
+			frames[i] = static_cast<float>(sine(static_cast<double>(i)));
+		}
+		const auto src = test_wav{std::move(frames)};
+		for (const auto frame_inc : FRAME_INCS) {
+			INFO("frame_inc " << frame_inc);
+			const auto pos = 200.61;
+			const auto out = resample_sinc(src, pos, frame_inc, 5000);
+			CHECK(max_error(out, [=](size_t i) { return sine(pos + i * frame_inc); }) < 1.0e-3);
+		}
+	}
+	SUBCASE("nothing is read past the ends of the file") {
+		const auto src = test_wav{std::vector<float>(FRAME_COUNT, 0.5f)};
+		for (const auto frame_inc : FRAME_INCS) {
+			INFO("frame_inc " << frame_inc);
+			// From before the start, across the whole file and out past the end.
+			const auto pos         = -100.5;
+			const auto frame_count = static_cast<size_t>((FRAME_COUNT + 200) / frame_inc);
+			const auto out         = resample_sinc(src, pos, frame_inc, frame_count);
+			auto outside = 0.0f;
+			auto inside  = 0.0f;
+			for (size_t i = 0; i < frame_count; i++) {
+				const auto fr = pos + i * frame_inc;
+				if (fr < -static_cast<double>(TAPS) || fr > static_cast<double>(FRAME_COUNT + TAPS)) {
+					outside = std::max(outside, std::abs(out[i]));
+				}
+				else {
+					inside = std::max(inside, std::abs(out[i]));
+				}
+			}
+			CHECK(outside == 0.0f);
+			// The kernel's ringing at the edges is the only overshoot.
+			CHECK(inside < 0.6f);
+		}
+	}
+}
+
+TEST_CASE("choose_chunk_size") {
+	struct row {
+		const char* name;
+		std::optional<uint64_t> frame_count;
+		size_t chunk_size;
+		size_t default_chunk_size;
+		size_t expected;
+	};
+	static constexpr auto DEFAULT = size_t{afs::DEFAULT_CHUNK_SIZE};
+	const auto rows = std::vector<row>{
+		{"unknown length",                      std::nullopt,                   0,     DEFAULT, DEFAULT},
+		{"short file rounds up",                5000,                           0,     DEFAULT, 8192},
+		{"short file already a power of two",   4096,                           0,     DEFAULT, 4096},
+		{"tiny file",                           10,                             0,     DEFAULT, 1024},
+		{"tiny file, small default",            10,                             0,     256,     256},
+		{"exactly one chunk",                   DEFAULT,                        0,     DEFAULT, DEFAULT},
+		{"long file",                           uint64_t{DEFAULT} * 2048,       0,     DEFAULT, DEFAULT},
+		{"too many chunks rounds up",           uint64_t{DEFAULT} * 3000,       0,     DEFAULT, DEFAULT * 2},
+		{"very long file stops growing",        uint64_t{DEFAULT} * 2048 * 100, 0,     DEFAULT, DEFAULT * 16},
+		{"explicit, unknown length",            std::nullopt,                   4096,  DEFAULT, 4096},
+		{"explicit, short file",                1000,                           10000, DEFAULT, 10000},
+		{"explicit, very long file",            uint64_t{DEFAULT} * 2048 * 100, 8192,  DEFAULT, 8192},
+	};
+	for (const auto& x : rows) {
+		INFO(x.name);
+		CHECK(detail::choose_chunk_size(make_header(2, 44100, x.frame_count), x.chunk_size, x.default_chunk_size) == x.expected);
+	}
+	SUBCASE("an explicit chunk size reaches the loader") {
+		const auto x = make_test_impl(make_mock_mp3<mock_stream>(2, 1000, true), {.chunk_size = 3000});
+		CHECK(x->shared.chunks.chunk_size == 3000);
+		CHECK(x->loader.state.chunk_size == 3000);
+	}
+}
+
+// A stream which can seek to any frame.
+static auto make_mock_wav(size_t channel_count, size_t frame_count) -> mock_stream {
+	auto out = mock_stream{};
+	out.header               = make_header(channel_count, 44100, frame_count);
+	out.header.stream_length = frame_count * mock_stream::BYTES_PER_FRAME;
+	out.frame_count          = frame_count;
+	return out;
+}
+
+TEST_CASE("the loader doesn't move the reported playback position") {
+	static constexpr auto CHUNK_SIZE = size_t{4096};
+	static constexpr auto BLOCK      = size_t{256};
+	auto x     = make_test_impl(make_mock_wav(2, CHUNK_SIZE * 10), {.chunk_size = CHUNK_SIZE});
+	auto left  = std::vector<float>(BLOCK);
+	auto right = std::vector<float>(BLOCK);
+	const auto target = ads::frame_idx{static_cast<int64_t>(CHUNK_SIZE * 7 + 100)};
+	SUBCASE("a seek the audio thread hasn't got to yet") {
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		detail::seek(ez::nort, x.get(), target);
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		// The loader went straight to the target.
+		CHECK(x->loader.state.chunks.size() == 8);
+		CHECK(detail::is_bit_set(x->shared.loaded, 7));
+		CHECK(detail::get_playback_chunk(x->shared, x->loader.state) == 7);
+		CHECK(x->shared.atomics.reported_playback_pos.load() == 0.0);
+		// Once the audio thread is there, what it reports is used.
+		detail::request_playback_pos(ez::nort, x.get());
+		detail::process(ez::audio, x.get(), 44100.0, {left.data(), right.data()}, BLOCK);
+		CHECK(detail::get_playhead_pos(x->shared, x->loader.state) == static_cast<double>(target.value + BLOCK));
+	}
+	SUBCASE("a seek the audio thread has already played past") {
+		while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+		detail::seek(ez::nort, x.get(), target);
+		for (size_t i = 0; i < 4; i++) {
+			detail::request_playback_pos(ez::nort, x.get());
+			detail::process(ez::audio, x.get(), 44100.0, {left.data(), right.data()}, BLOCK);
+		}
+		const auto played = static_cast<double>(target.value + 4 * BLOCK);
+		REQUIRE(x->shared.atomics.reported_playback_pos.load() == played);
+		CHECK(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::finished);
+		CHECK(x->shared.atomics.reported_playback_pos.load() == played);
+		CHECK(detail::get_playhead_pos(x->shared, x->loader.state) == played);
+	}
+}
+
+TEST_CASE("loader stats and sequential reads") {
+	static constexpr auto CHUNK_SIZE  = size_t{4096};
+	static constexpr auto CHUNK_COUNT = size_t{10};
+	auto stream = make_mock_wav(2, CHUNK_SIZE * CHUNK_COUNT - 300);
+	auto log    = stream.log;
+	auto x      = make_test_impl(std::move(stream), {.chunk_size = CHUNK_SIZE});
+	SUBCASE("front to back needs no seeks") {
+		while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+		const auto stats = detail::get_loader_stats(ez::nort, x.get());
+		CHECK(stats.stream_seeks == 0);
+		CHECK(stats.chunks_decoded == CHUNK_COUNT);
+		CHECK(log->seeks == 0);
+	}
+	SUBCASE("a jump costs one seek") {
+		for (size_t i = 0; i < 3; i++) {
+			REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		}
+		detail::seek(ez::nort, x.get(), ads::frame_idx{static_cast<int64_t>(CHUNK_SIZE * 7 + 100)});
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(detail::is_bit_set(x->shared.loaded, 7));
+		CHECK(detail::get_loader_stats(ez::nort, x.get()).stream_seeks == 1);
+		// Carrying on from there is sequential again.
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(detail::is_bit_set(x->shared.loaded, 8));
+		CHECK(detail::get_loader_stats(ez::nort, x.get()).stream_seeks == 1);
+		while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+		// One more to go back for the chunks the jump skipped.
+		const auto stats = detail::get_loader_stats(ez::nort, x.get());
+		CHECK(stats.stream_seeks == 2);
+		CHECK(stats.chunks_decoded == CHUNK_COUNT);
+		CHECK(log->seeks == stats.stream_seeks);
+		for (size_t i = 0; i < CHUNK_COUNT; i++) {
+			CHECK(is_chunk_correct(*x->loader.state.chunks[i], CHUNK_SIZE, i, 2));
+		}
+	}
+}
+
+TEST_CASE("seeking into the middle of a chunk") {
+	static constexpr auto CHUNK_SIZE = size_t{65536};
+	static constexpr auto SLICE_SIZE = size_t{4096}; // For two channels.
+	// Far enough in to start decoding there, and not on a slice boundary,
+	// so the pass back over the front of the chunk ends with a short slice.
+	static constexpr auto LOCAL_FR   = detail::DECODE_SLICE_SIZE + SLICE_SIZE + 1234;
+	static constexpr auto TARGET     = CHUNK_SIZE + LOCAL_FR;
+	auto pool = afs::chunk_pool{ez::nort, size_t{1} << 24};
+	// Leave a buffer full of junk in the pool so the chunk gets a recycled one.
+	{
+		const auto junk = detail::make_chunk_data(ez::nort, pool.get_impl(ez::nort), afs::sample_format::float32, ads::channel_count{2}, CHUNK_SIZE);
+		std::ranges::fill(junk->bytes, std::byte{0x7f});
+	}
+	auto stream = make_mock_wav(2, CHUNK_SIZE * 3);
+	auto log    = stream.log;
+	auto x      = make_test_impl(std::move(stream), {.chunk_pool = pool.get_impl(ez::nort), .chunk_size = CHUNK_SIZE});
+	auto ranges = std::vector<detail::ready_range>{};
+	log->on_read = [&] {
+		if (const auto chunk = detail::find_chunk(ez::audio, x->shared.chunks, 1)) {
+			ranges.push_back(detail::get_ready_range(*chunk));
+		}
+	};
+	detail::seek(ez::nort, x.get(), ads::frame_idx{static_cast<int64_t>(TARGET)});
+	REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+	log->on_read = nullptr;
+	REQUIRE(x->loader.state.chunks.size() == 2);
+	const auto& chunk = *x->loader.state.chunks[1];
+	CHECK(pool.get_impl(ez::nort)->buffers.at(CHUNK_SIZE * 2 * sizeof(float)).empty());
+	// The frames from the target on were published first, a slice at a
+	// time, while the frames in front of it were still to come.
+	REQUIRE(ranges.size() > 2);
+	CHECK(ranges.front().beg == LOCAL_FR);
+	CHECK(ranges.front().end == LOCAL_FR + SLICE_SIZE);
+	for (size_t i = 1; i < ranges.size(); i++) {
+		CHECK(ranges[i].end >= ranges[i - 1].end);
+		CHECK((ranges[i].beg == LOCAL_FR || ranges[i].beg == 0));
+	}
+	CHECK(std::ranges::count_if(ranges, [](const detail::ready_range& x) { return x.beg == LOCAL_FR && x.end == CHUNK_SIZE; }) > 0);
+	CHECK(detail::get_ready_range(chunk).beg == 0);
+	CHECK(detail::get_ready_range(chunk).end == CHUNK_SIZE);
+	// Once filled in, the chunk is the same as one decoded straight through.
+	CHECK(is_chunk_correct(chunk, CHUNK_SIZE, 1, 2));
+	auto straight = make_test_impl(make_mock_wav(2, CHUNK_SIZE * 3), {.chunk_size = CHUNK_SIZE});
+	while (detail::load_next_chunk(ez::nort, &straight->loader, &straight->shared) != detail::load_result::finished) {}
+	CHECK(std::ranges::equal(chunk.bytes, straight->loader.state.chunks[1]->bytes));
+	// Out to the end and back to the start of the chunk.
+	CHECK(log->seeks == 2);
+}
+
+TEST_CASE("a seek preempts the chunk being decoded") {
+	static constexpr auto CHUNK_SIZE  = size_t{16384};
+	static constexpr auto SLICE_SIZE  = size_t{4096}; // For two channels.
+	static constexpr auto CHUNK_BYTES = CHUNK_SIZE * 2 * sizeof(float);
+	const auto target = ads::frame_idx{static_cast<int64_t>(CHUNK_SIZE * 5 + 10)};
+	const auto run = [&](mock_stream stream) {
+		auto log   = stream.log;
+		auto x     = make_test_impl(std::move(stream), {.max_bytes = CHUNK_BYTES * 4, .chunk_size = CHUNK_SIZE});
+		auto reads = size_t{0};
+		log->on_read = [&] {
+			if (++reads == 2) {
+				detail::seek(ez::nort, x.get(), target);
+				CHECK(x->loader.wakeup.signalled);
+			}
+		};
+		const auto result = detail::load_next_chunk(ez::nort, &x->loader, &x->shared);
+		log->on_read = nullptr;
+		return std::tuple{std::move(x), result, reads};
+	};
+	SUBCASE("the chunk is given up on between slices") {
+		auto [x, result, reads] = run(make_mock_wav(2, CHUNK_SIZE * 8));
+		CHECK(result == detail::load_result::interrupted);
+		CHECK(reads == 2);
+		CHECK_FALSE(detail::is_bit_set(x->shared.loaded, 0));
+		CHECK(detail::find_chunk(ez::audio, x->shared.chunks, 0) == nullptr);
+		// What was reserved for it is given back.
+		CHECK(x->loader.state.usage.bytes == 0);
+		// And the target is loaded next.
+		REQUIRE(detail::load_next_chunk(ez::nort, &x->loader, &x->shared) == detail::load_result::loaded);
+		CHECK(detail::is_bit_set(x->shared.loaded, 5));
+		CHECK(is_chunk_correct(*x->loader.state.chunks[5], CHUNK_SIZE, 5, 2));
+		CHECK(x->loader.state.usage.bytes == CHUNK_BYTES);
+	}
+	SUBCASE("an MP3 without a seek index finishes the chunk") {
+		auto [x, result, reads] = run(make_mock_mp3<mock_stream>(2, CHUNK_SIZE * 8, true));
+		CHECK(result == detail::load_result::loaded);
+		CHECK(reads == CHUNK_SIZE / SLICE_SIZE);
+		CHECK(detail::is_bit_set(x->shared.loaded, 0));
+		CHECK(is_chunk_correct(*x->loader.state.chunks[0], CHUNK_SIZE, 0, 2));
+		CHECK(x->loader.state.usage.bytes == CHUNK_BYTES);
+	}
+}
+
+TEST_CASE("chunks are decoded a slice at a time") {
+	static constexpr auto CHANNELS    = size_t{3};
+	static constexpr auto CHUNK_SIZE  = size_t{10000};
+	static constexpr auto FRAME_COUNT = CHUNK_SIZE * 3 + 777;
+	const auto slice_size = detail::get_decode_slice_size(ads::channel_count{CHANNELS});
+	REQUIRE(CHUNK_SIZE % slice_size != 0);
+	REQUIRE(CHUNK_SIZE % detail::DECODE_SLICE_SIZE != 0);
+	// Chunk 1 is silent. Chunk 2 is silent until its last few frames, which
+	// are in its last slice.
+	const auto with_silence = [](mock_stream stream) {
+		stream.silent_beg = CHUNK_SIZE;
+		stream.silent_end = CHUNK_SIZE * 3 - 10;
+		return stream;
+	};
+	auto source = std::vector<float>(FRAME_COUNT * CHANNELS);
+	{
+		auto stream = with_silence(make_mock_wav(CHANNELS, FRAME_COUNT));
+		REQUIRE(stream.read_frames(source) == ads::frame_count{FRAME_COUNT});
+	}
+	const auto is_same_as_source = [&](const detail::chunk_data& chunk, size_t chunk_idx) {
+		for (size_t ch = 0; ch < CHANNELS; ch++) {
+			const auto data = reinterpret_cast<const float*>(detail::get_channel_data(chunk, ads::channel_idx{ch}));
+			for (size_t i = 0; i < chunk.frame_count; i++) {
+				if (data[i] != source[(chunk_idx * CHUNK_SIZE + i) * CHANNELS + ch]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	};
+	const auto check = [&](mock_stream stream) {
+		auto x = make_test_impl(with_silence(std::move(stream)), {.chunk_size = CHUNK_SIZE});
+		while (detail::load_next_chunk(ez::nort, &x->loader, &x->shared) != detail::load_result::finished) {}
+		const auto& chunks = x->loader.state.chunks;
+		REQUIRE(chunks.size() == 4);
+		CHECK(chunks[1] == detail::get_silent_chunk());
+		for (const auto i : {size_t{0}, size_t{2}, size_t{3}}) {
+			CHECK_FALSE(chunks[i]->silent);
+			CHECK(is_same_as_source(*chunks[i], i));
+		}
+		// The last chunk is exactly as big as it needs to be.
+		CHECK(chunks[3]->frame_count == 777);
+		CHECK(chunks[3]->bytes.size() == 777 * CHANNELS * sizeof(float));
+		CHECK(x->shared.model.read(ez::nort).header.frame_count == ads::frame_count{FRAME_COUNT});
+	};
+	SUBCASE("known length") {
+		check(make_mock_wav(CHANNELS, FRAME_COUNT));
+	}
+	SUBCASE("unknown length, so the last chunk is trimmed after decoding") {
+		check(make_mock_mp3<mock_stream>(CHANNELS, FRAME_COUNT, false));
+	}
+}